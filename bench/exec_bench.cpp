@@ -0,0 +1,459 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+using clock_type = std::chrono::steady_clock;
+
+
+
+struct command_line
+{
+  command_line(int argc, char** argv);
+
+  std::string binary;
+  std::string stub;
+  std::string testDir;
+  std::vector<std::string> strategies;
+  std::vector<unsigned> depths;
+  unsigned rounds{100};
+  unsigned port{18444};
+};
+
+
+
+/// Splits the comma-separated \a list.
+static std::vector<std::string> split_list(const std::string& list)
+{
+  std::vector<std::string> result;
+  std::istringstream in{list};
+  for (std::string item; std::getline(in, item, ',');)
+    if (!item.empty())
+      result.push_back(item);
+
+  return result;
+}
+
+
+
+command_line::command_line(int argc, char** argv)
+{
+  using namespace boost::program_options;
+
+  std::string strategyList;
+  std::string depthList;
+
+  options_description options{"Options:"};
+  options.add_options()
+      ("help,h", "Show this help.")
+      ("binary", value<std::string>(&binary)->default_value(GITLAB_HOOK_BINARY), "Sets the gitlab-hook binary to benchmark.")
+      ("stub", value<std::string>(&stub)->default_value(EXEC_STUB_BINARY), "Sets the stub command that reports its start time.")
+      ("test-dir", value<std::string>(&testDir)->default_value(TEST_SOURCE_DIR), "Sets the directory with the test event.")
+      ("spawn", value<std::string>(&strategyList)->default_value("fork,vfork"), "Sets the comma-separated spawn strategies to compare.")
+      ("depth", value<std::string>(&depthList)->default_value("1,4,16"), "Sets the comma-separated numbers of events sent at once.")
+      ("rounds", value<unsigned>(&rounds)->default_value(rounds), "Sets the number of bursts of events per strategy and depth.")
+      ("port", value<unsigned>(&port)->default_value(port), "Sets the port for gitlab-hook to listen on.");
+
+  variables_map vm;
+  store(parse_command_line(argc, argv, options), vm);
+  notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << "gitlab-hook-exec-bench [OPTION]...\n\n"
+              << "Starts gitlab-hook once per spawn strategy with a hook that executes a stub\n"
+              << "command, and sends it bursts of pipeline events over the loopback interface.\n"
+              << "Reports the latency from sending an event until the stub command started,\n"
+              << "per spawn strategy and number of events sent at once.\n\n"
+              << options;
+    std::exit(0);
+  }
+
+  strategies = split_list(strategyList);
+  for (auto& depth: split_list(depthList))
+    depths.push_back(static_cast<unsigned>(std::stoul(depth)));
+
+  if (strategies.empty() || depths.empty() || rounds == 0 || std::count(depths.begin(), depths.end(), 0u))
+    throw std::runtime_error{"spawn, depth and rounds must not be empty or zero"};
+}
+
+
+
+/// A temporary directory with the stub command and the FIFO it writes to,
+/// accessible for the user the commands are executed as.
+struct bench_dir
+{
+  explicit bench_dir(const command_line& cmdline);
+  ~bench_dir();
+
+  std::filesystem::path path;
+  std::filesystem::path stub;
+  std::filesystem::path fifo;
+  int fifoFd{-1};
+};
+
+
+
+bench_dir::bench_dir(const command_line& cmdline)
+{
+  char dirTemplate[] = "/tmp/gitlab-hook-exec-bench.XXXXXX";
+  if (!mkdtemp(dirTemplate))
+    throw std::system_error{errno, std::system_category(), "failed to create temporary directory"};
+
+  path = dirTemplate;
+  stub = path / "stub";
+  fifo = path / "started";
+  chmod(dirTemplate, 0755);
+
+  std::filesystem::copy_file(cmdline.stub, stub);
+  chmod(stub.c_str(), 0755);
+
+  if (mkfifo(fifo.c_str(), 0666) == -1 || chmod(fifo.c_str(), 0666) == -1)
+    throw std::system_error{errno, std::system_category(), "failed to create FIFO"};
+
+  // Opened for writing as well, so that reads never see the end of file.
+  fifoFd = open(fifo.c_str(), O_RDWR|O_CLOEXEC|O_NONBLOCK);
+  if (fifoFd == -1)
+    throw std::system_error{errno, std::system_category(), "failed to open FIFO"};
+}
+
+
+
+bench_dir::~bench_dir()
+{
+  close(fifoFd);
+  std::error_code error;
+  std::filesystem::remove_all(path, error);
+}
+
+
+
+static std::filesystem::path write_config(const command_line& cmdline, const bench_dir& dir, const std::string& strategy)
+{
+  auto maxDepth = *std::max_element(cmdline.depths.begin(), cmdline.depths.end());
+  auto fileName = dir.path / ("config-" + strategy + ".ini");
+
+  std::ofstream out{fileName};
+  out << "spawn = \"" << strategy << "\"\n"
+      << "shutdown_timeout = 0\n\n"
+      << "[httpd]\n"
+      << "ip = \"127.0.0.1\"\n"
+      << "port = " << cmdline.port << "\n"
+      << "max_connections = " << maxDepth * 2 << "\n"
+      << "max_connections_per_ip = " << maxDepth * 2 << "\n\n"
+      << "[[hooks]]\n"
+      << "uri_path = \"/bench\"\n"
+      << "type = \"pipeline\"\n"
+      << "name = \"bench\"\n"
+      << "token = \"bench\"\n"
+      << "status = \"success\"\n"
+      << "job_name = [\"build-image\"]\n"
+      << "command = \"" << dir.stub.string() << " " << dir.fifo.string() << "\"\n";
+
+  if (geteuid() == 0)
+    out << "run_as = { user = \"nobody\" }\n";
+
+  if (!out)
+    throw std::runtime_error{"failed to write configuration file"};
+
+  return fileName;
+}
+
+
+
+static int connect_loopback(unsigned port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    throw std::system_error{errno, std::system_category(), "failed to create socket"};
+
+  sockaddr_in addr{};
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(static_cast<uint16_t>(port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+
+static pid_t start_daemon(const command_line& cmdline, const std::filesystem::path& config)
+{
+  auto log = config.string() + ".log";
+
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid == -1)
+    throw std::system_error{errno, std::system_category(), "failed to fork"};
+
+  if (pid == 0)
+  {
+    freopen(log.c_str(), "w", stdout);
+    freopen(log.c_str(), "a", stderr);
+    execl(cmdline.binary.c_str(), cmdline.binary.c_str(), "--config", config.c_str(), static_cast<char*>(nullptr));
+    fprintf(stderr, "execute %s failed: %s\n", cmdline.binary.c_str(), strerror(errno));
+    _exit(127);
+  }
+
+  for (auto deadline = clock_type::now() + 10s; clock_type::now() < deadline; std::this_thread::sleep_for(50ms))
+  {
+    int status;
+    if (waitpid(pid, &status, WNOHANG) == pid)
+      throw std::runtime_error{"gitlab-hook exited prematurely, see " + log};
+
+    int fd = connect_loopback(cmdline.port);
+    if (fd != -1)
+    {
+      close(fd);
+      return pid;
+    }
+  }
+
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+  throw std::runtime_error{"gitlab-hook did not start listening, see " + log};
+}
+
+
+
+static void stop_daemon(pid_t pid)
+{
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+}
+
+
+
+/// Sends pipeline events with unique pipeline IDs and collects the start
+/// times reported by the stub command.
+class event_source
+{
+  public:
+    event_source(const command_line& cmdline, int fifoFd);
+
+    /// Sends \a depth events at once and returns the latency of each until
+    /// its command started, in microseconds, in the order they were sent.
+    std::vector<double> burst(unsigned depth);
+
+  private:
+    std::string request(std::uint64_t pipelineId) const;
+
+    nlohmann::json mEvent;
+    unsigned mPort;
+    int mFifoFd;
+    std::uint64_t mNextId{1000000};
+};
+
+
+
+event_source::event_source(const command_line& cmdline, int fifoFd)
+  : mPort{cmdline.port},
+    mFifoFd{fifoFd}
+{
+  std::ifstream in{cmdline.testDir + "/pipeline_event.json"};
+  if (!in)
+    throw std::runtime_error{"failed to read " + cmdline.testDir + "/pipeline_event.json"};
+
+  mEvent = nlohmann::json::parse(in);
+}
+
+
+
+std::string event_source::request(std::uint64_t pipelineId) const
+{
+  auto event = mEvent;
+  event["object_attributes"]["id"] = pipelineId;
+  auto body = event.dump();
+
+  std::ostringstream out;
+  out << "POST /bench HTTP/1.1\r\n"
+      << "Host: localhost\r\n"
+      << "X-Gitlab-Token: bench\r\n"
+      << "X-Gitlab-Event: Pipeline Hook\r\n"
+      << "Content-Type: application/json\r\n"
+      << "Content-Length: " << body.size() << "\r\n"
+      << "Connection: close\r\n\r\n"
+      << body;
+
+  return out.str();
+}
+
+
+
+static void write_all(int fd, std::string_view data)
+{
+  while (!data.empty())
+  {
+    auto n = write(fd, data.data(), data.size());
+    if (n == -1)
+      throw std::system_error{errno, std::system_category(), "failed to send request"};
+
+    data.remove_prefix(static_cast<std::size_t>(n));
+  }
+}
+
+
+
+std::vector<double> event_source::burst(unsigned depth)
+{
+  auto firstId = mNextId;
+  mNextId += depth;
+
+  std::vector<std::string> requests;
+  std::vector<int> sockets;
+  for (unsigned i = 0; i != depth; ++i)
+  {
+    requests.push_back(request(firstId + i));
+    sockets.push_back(connect_loopback(mPort));
+    if (sockets.back() == -1)
+      throw std::system_error{errno, std::system_category(), "failed to connect to gitlab-hook"};
+  }
+
+  std::vector<clock_type::time_point> sent(depth);
+  for (unsigned i = 0; i != depth; ++i)
+  {
+    sent[i] = clock_type::now();
+    write_all(sockets[i], requests[i]);
+  }
+
+  for (int fd: sockets)
+  {
+    char response[512];
+    auto n = read(fd, response, sizeof(response));
+    close(fd);
+
+    if (n < 12 || std::string_view{response, 7} != "HTTP/1." || response[9] != '2')
+      throw std::runtime_error{"gitlab-hook did not accept the event"};
+  }
+
+  std::vector<double> result(depth, -1);
+  for (unsigned received = 0; received != depth;)
+  {
+    pollfd pfd{mFifoFd, POLLIN, 0};
+    if (poll(&pfd, 1, 10000) != 1)
+      throw std::runtime_error{"timeout waiting for the stub command to start"};
+
+    std::uint64_t record[2];
+    if (read(mFifoFd, record, sizeof(record)) != sizeof(record))
+      continue;
+
+    if (record[0] < firstId || record[0] >= firstId + depth)
+      continue;  // a late command from an earlier burst
+
+    auto started = clock_type::time_point{std::chrono::nanoseconds{record[1]}};
+    auto index   = record[0] - firstId;
+    result[index] = std::chrono::duration<double,std::micro>{started - sent[index]}.count();
+    ++received;
+  }
+
+  return result;
+}
+
+
+
+static double percentile(const std::vector<double>& sorted, double fraction)
+{
+  auto index = static_cast<std::size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+
+
+int main(int argc, char** argv)
+try {
+  // NOTE: The stub reports CLOCK_MONOTONIC, which is what steady_clock uses on Linux.
+  static_assert(std::is_same_v<clock_type::duration, std::chrono::nanoseconds>);
+  const command_line cmdline{argc, argv};
+  bench_dir dir{cmdline};
+
+  std::cout << "strategy  depth  events   p50 µs   p90 µs   p99 µs   max µs  first p50 µs\n";
+  for (auto& strategy: cmdline.strategies)
+  {
+    auto daemon = start_daemon(cmdline, write_config(cmdline, dir, strategy));
+    try {
+      event_source events{cmdline, dir.fifoFd};
+      events.burst(1);  // warm up
+
+      for (auto depth: cmdline.depths)
+      {
+        std::vector<double> all, first;
+        for (unsigned round = 0; round != cmdline.rounds; ++round)
+        {
+          auto latencies = events.burst(depth);
+          first.push_back(latencies.front());
+          all.insert(all.end(), latencies.begin(), latencies.end());
+
+          // Let the last command exit, so that bursts do not overlap.
+          std::this_thread::sleep_for(5ms);
+        }
+
+        std::sort(all.begin(), all.end());
+        std::sort(first.begin(), first.end());
+        std::cout << std::fixed << std::setprecision(0)
+                  << std::left << std::setw(8) << strategy << std::right
+                  << std::setw(7) << depth
+                  << std::setw(8) << all.size()
+                  << std::setw(9) << percentile(all, 0.5)
+                  << std::setw(9) << percentile(all, 0.9)
+                  << std::setw(9) << percentile(all, 0.99)
+                  << std::setw(9) << all.back()
+                  << std::setw(14) << percentile(first, 0.5) << "\n";
+      }
+    }
+    catch (...)
+    {
+      stop_daemon(daemon);
+      throw;
+    }
+
+    stop_daemon(daemon);
+  }
+
+  return 0;
+}
+catch (const std::exception& e)
+{
+  std::cerr << "gitlab-hook-exec-bench: " << e.what() << std::endl;
+  return 1;
+}
@@ -0,0 +1,49 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+
+// A command for gitlab-hook-exec-bench. As its first instruction, it takes the
+// time, and writes the CI_PIPELINE_ID and the time in nanoseconds of
+// CLOCK_MONOTONIC as two 64 bit integers to the FIFO given as argument.
+int main(int argc, char** argv)
+{
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (argc != 2)
+    return 2;
+
+  auto pipelineId = std::getenv("CI_PIPELINE_ID");
+  std::uint64_t record[2] = {
+    pipelineId ? std::strtoull(pipelineId, nullptr, 10) : 0,
+    static_cast<std::uint64_t>(now.tv_sec) * 1000000000u + static_cast<std::uint64_t>(now.tv_nsec)
+  };
+
+  int fd = open(argv[1], O_WRONLY|O_CLOEXEC);
+  if (fd == -1)
+    return 1;
+
+  // Less than PIPE_BUF, so the write is atomic.
+  return write(fd, record, sizeof(record)) == sizeof(record) ? 0 : 1;
+}
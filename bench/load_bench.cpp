@@ -0,0 +1,427 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <curl/curl.h>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <netinet/in.h>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using namespace std::chrono_literals;
+using clock_type = std::chrono::steady_clock;
+
+
+
+struct command_line
+{
+  command_line(int argc, char** argv);
+
+  std::string binary;
+  std::string testDir;
+  unsigned clients{16};
+  double rate{200};
+  unsigned duration{10};
+  unsigned port{18443};
+};
+
+
+
+command_line::command_line(int argc, char** argv)
+{
+  using namespace boost::program_options;
+
+  options_description options{"Options:"};
+  options.add_options()
+      ("help,h", "Show this help.")
+      ("binary", value<std::string>(&binary)->default_value(GITLAB_HOOK_BINARY), "Sets the gitlab-hook binary to benchmark.")
+      ("test-dir", value<std::string>(&testDir)->default_value(TEST_SOURCE_DIR), "Sets the directory with the test event and certificate.")
+      ("clients", value<unsigned>(&clients)->default_value(clients), "Sets the number of concurrent keep-alive clients.")
+      ("rate", value<double>(&rate)->default_value(rate), "Sets the target rate of requests per second.")
+      ("duration", value<unsigned>(&duration)->default_value(duration), "Sets the duration of the benchmark in seconds.")
+      ("port", value<unsigned>(&port)->default_value(port), "Sets the port for gitlab-hook to listen on.");
+
+  variables_map vm;
+  store(parse_command_line(argc, argv, options), vm);
+  notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << "gitlab-hook-bench [OPTION]...\n\n"
+              << "Starts gitlab-hook with a generated configuration and sends it pipeline events\n"
+              << "over HTTPS from concurrent keep-alive clients at a target rate. Reports the\n"
+              << "latency per HTTP status, measured from the scheduled send time, and the CPU\n"
+              << "time and memory used by gitlab-hook.\n\n"
+              << options;
+    std::exit(0);
+  }
+
+  if (clients == 0 || rate <= 0 || duration == 0)
+    throw std::runtime_error{"clients, rate and duration must be positive"};
+}
+
+
+
+/// A kind of request sent to gitlab-hook, with the expected response.
+struct request_variant
+{
+  std::string name;
+  std::string body;
+  curl_slist* headers{nullptr};
+  unsigned weight;
+};
+
+
+
+static std::vector<request_variant> make_variants(const std::string& testDir)
+{
+  std::ifstream in{testDir + "/pipeline_event.json"};
+  if (!in)
+    throw std::runtime_error{"failed to read " + testDir + "/pipeline_event.json"};
+
+  auto event = nlohmann::json::parse(in);
+
+  auto large  = event;
+  auto builds = large["builds"];
+  for (int i = 0; i != 200; ++i)
+  {
+    auto job    = builds[static_cast<std::size_t>(i) % builds.size()];
+    job["id"]   = 1000 + i;
+    job["name"] = "job-" + std::to_string(i);
+    large["builds"].push_back(std::move(job));
+  }
+
+  auto failed = event;
+  failed["object_attributes"]["status"] = "failed";
+
+  std::vector<request_variant> result;
+  result.push_back({"accepted", event.dump(), nullptr, 5});
+  result.push_back({"accepted, 205 jobs", large.dump(), nullptr, 1});
+  result.push_back({"ignored", failed.dump(), nullptr, 3});
+  result.push_back({"forbidden", event.dump(), nullptr, 1});
+
+  for (auto& variant: result)
+  {
+    auto token = variant.name == "forbidden" ? "X-Gitlab-Token: wrong" : "X-Gitlab-Token: bench";
+    variant.headers = curl_slist_append(variant.headers, token);
+    variant.headers = curl_slist_append(variant.headers, "X-Gitlab-Event: Pipeline Hook");
+    variant.headers = curl_slist_append(variant.headers, "Content-Type: application/json");
+    variant.headers = curl_slist_append(variant.headers, "Expect:");
+  }
+
+  return result;
+}
+
+
+
+static std::filesystem::path write_config(const command_line& cmdline)
+{
+  char dirTemplate[] = "/tmp/gitlab-hook-bench.XXXXXX";
+  if (!mkdtemp(dirTemplate))
+    throw std::system_error{errno, std::system_category(), "failed to create temporary directory"};
+
+  std::filesystem::path dir{dirTemplate};
+  std::ofstream out{dir / "config.ini"};
+  out << "[httpd]\n"
+      << "ip = \"127.0.0.1\"\n"
+      << "port = " << cmdline.port << "\n"
+      << "max_connections = " << cmdline.clients * 2 << "\n"
+      << "max_connections_per_ip = " << cmdline.clients * 2 << "\n"
+      << "certificate = \"" << cmdline.testDir << "/cert/cert.pem\"\n"
+      << "private_key = \"" << cmdline.testDir << "/cert/key.pem\"\n\n"
+      << "[[hooks]]\n"
+      << "uri_path = \"/bench\"\n"
+      << "type = \"pipeline\"\n"
+      << "name = \"bench\"\n"
+      << "token = \"bench\"\n"
+      << "peer_address = \"127.0.0.1\"\n"
+      << "status = \"success\"\n"
+      << "job_name = [\"build-image\"]\n"
+      << "command = \"/bin/true\"\n";
+
+  if (geteuid() == 0)
+    out << "run_as = { user = \"nobody\" }\n";
+
+  if (!out)
+    throw std::runtime_error{"failed to write configuration file"};
+
+  return dir;
+}
+
+
+
+static pid_t start_daemon(const command_line& cmdline, const std::filesystem::path& dir)
+{
+  auto config = (dir / "config.ini").string();
+  auto log    = (dir / "gitlab-hook.log").string();
+
+  pid_t pid = fork();
+  if (pid == -1)
+    throw std::system_error{errno, std::system_category(), "failed to fork"};
+
+  if (pid == 0)
+  {
+    freopen(log.c_str(), "w", stdout);
+    freopen(log.c_str(), "a", stderr);
+    execl(cmdline.binary.c_str(), cmdline.binary.c_str(), "--config", config.c_str(), static_cast<char*>(nullptr));
+    fprintf(stderr, "execute %s failed: %s\n", cmdline.binary.c_str(), strerror(errno));
+    _exit(127);
+  }
+
+  for (auto deadline = clock_type::now() + 10s; clock_type::now() < deadline; std::this_thread::sleep_for(50ms))
+  {
+    int status;
+    if (waitpid(pid, &status, WNOHANG) == pid)
+      throw std::runtime_error{"gitlab-hook exited prematurely, see " + log};
+
+    int fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(static_cast<uint16_t>(cmdline.port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    bool connected = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    close(fd);
+    if (connected)
+      return pid;
+  }
+
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+  throw std::runtime_error{"gitlab-hook did not start listening, see " + log};
+}
+
+
+
+/// CPU time and memory usage of a process, from the /proc file system.
+struct process_usage
+{
+  double cpuSeconds{0};
+  long rssKiB{0};
+  long peakRssKiB{0};
+
+  static process_usage of(pid_t pid);
+};
+
+
+
+process_usage process_usage::of(pid_t pid)
+{
+  process_usage result;
+
+  std::ifstream stat{"/proc/" + std::to_string(pid) + "/stat"};
+  std::string statLine;
+  std::getline(stat, statLine);
+
+  // Skip "pid (comm) " which may contain spaces, then fields 3 to 15.
+  std::istringstream fields{statLine.substr(statLine.rfind(')') + 2)};
+  std::string field;
+  unsigned long utime = 0, stime = 0;
+  for (int i = 3; i <= 15 && fields >> field; ++i)
+    if (i == 14)
+      utime = std::stoul(field);
+    else if (i == 15)
+      stime = std::stoul(field);
+
+  result.cpuSeconds = static_cast<double>(utime + stime) / static_cast<double>(sysconf(_SC_CLK_TCK));
+
+  std::ifstream status{"/proc/" + std::to_string(pid) + "/status"};
+  for (std::string line; std::getline(status, line);)
+    if (line.starts_with("VmRSS:"))
+      result.rssKiB = std::stol(line.substr(6));
+    else if (line.starts_with("VmHWM:"))
+      result.peakRssKiB = std::stol(line.substr(6));
+
+  return result;
+}
+
+
+
+/// A keep-alive client with at most one request in flight.
+struct client
+{
+  CURL* handle{nullptr};
+  clock_type::time_point scheduled;
+  bool busy{false};
+};
+
+
+
+static double percentile(const std::vector<double>& sorted, double fraction)
+{
+  auto index = static_cast<std::size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+
+
+static void run_benchmark(const command_line& cmdline, std::vector<request_variant>& variants, pid_t daemon)
+{
+  std::vector<unsigned> schedule;
+  for (unsigned i = 0; i != variants.size(); ++i)
+    schedule.insert(schedule.end(), variants[i].weight, i);
+
+  auto url  = "https://localhost:" + std::to_string(cmdline.port) + "/bench";
+  auto cert = cmdline.testDir + "/cert/cert.pem";
+
+  CURLM* multi = curl_multi_init();
+  std::vector<client> clients(cmdline.clients);
+  for (auto& c: clients)
+  {
+    c.handle = curl_easy_init();
+    curl_easy_setopt(c.handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(c.handle, CURLOPT_CAINFO, cert.c_str());
+    curl_easy_setopt(c.handle, CURLOPT_PRIVATE, &c);
+    curl_easy_setopt(c.handle, CURLOPT_WRITEFUNCTION, +[](char*, size_t size, size_t count, void*) { return size * count; });
+  }
+
+  std::map<long,std::vector<double>> latencies;
+  std::size_t errors = 0;
+  std::size_t sent   = 0;
+
+  auto before   = process_usage::of(daemon);
+  auto start    = clock_type::now();
+  auto end      = start + std::chrono::seconds{cmdline.duration};
+  auto interval = std::chrono::duration<double>{1.0 / cmdline.rate};
+  auto nextSend = start;
+
+  for (int running = 0; nextSend < end || running;)
+  {
+    auto now = clock_type::now();
+    while (nextSend <= now && nextSend < end)
+    {
+      auto idle = std::find_if(clients.begin(), clients.end(), [](const client& c) { return !c.busy; });
+      if (idle == clients.end())
+        break;  // late requests keep their scheduled time
+
+      auto& variant = variants[schedule[sent % schedule.size()]];
+      curl_easy_setopt(idle->handle, CURLOPT_HTTPHEADER, variant.headers);
+      curl_easy_setopt(idle->handle, CURLOPT_POSTFIELDS, variant.body.data());
+      curl_easy_setopt(idle->handle, CURLOPT_POSTFIELDSIZE, static_cast<long>(variant.body.size()));
+      curl_multi_add_handle(multi, idle->handle);
+
+      idle->busy      = true;
+      idle->scheduled = nextSend;
+      nextSend        = start + std::chrono::duration_cast<clock_type::duration>(interval * static_cast<double>(++sent));
+    }
+
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nextSend - clock_type::now()).count();
+    curl_multi_poll(multi, nullptr, 0, static_cast<int>(std::clamp<long long>(wait, 0, 100)), nullptr);
+    curl_multi_perform(multi, &running);
+
+    int queued;
+    while (auto msg = curl_multi_info_read(multi, &queued))
+    {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      client* c;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &c);
+      auto latency = std::chrono::duration<double,std::milli>{clock_type::now() - c->scheduled}.count();
+
+      long code = 0;
+      if (msg->data.result == CURLE_OK)
+      {
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
+        latencies[code].push_back(latency);
+      }
+      else
+        ++errors;
+
+      curl_multi_remove_handle(multi, msg->easy_handle);
+      c->busy = false;
+    }
+  }
+
+  auto elapsed = std::chrono::duration<double>{clock_type::now() - start}.count();
+  auto after   = process_usage::of(daemon);
+
+  for (auto& c: clients)
+    curl_easy_cleanup(c.handle);
+  curl_multi_cleanup(multi);
+
+  std::cout << "sent " << sent << " requests in " << std::fixed << std::setprecision(1) << elapsed << " s ("
+            << static_cast<double>(sent) / elapsed << " req/s) with " << cmdline.clients << " clients, "
+            << errors << " transport errors\n\n";
+
+  std::cout << std::setw(6) << "status" << std::setw(10) << "count" << std::setw(12) << "p50[ms]"
+            << std::setw(12) << "p99[ms]" << std::setw(12) << "p999[ms]" << std::setw(12) << "max[ms]" << "\n";
+
+  std::cout << std::setprecision(2);
+  for (auto& [code, values]: latencies)
+  {
+    std::sort(values.begin(), values.end());
+    std::cout << std::setw(6) << code << std::setw(10) << values.size() << std::setw(12) << percentile(values, 0.5)
+              << std::setw(12) << percentile(values, 0.99) << std::setw(12) << percentile(values, 0.999)
+              << std::setw(12) << values.back() << "\n";
+  }
+
+  auto cpu = after.cpuSeconds - before.cpuSeconds;
+  std::cout << "\ngitlab-hook: " << std::setprecision(2) << cpu << " s CPU (" << std::setprecision(1)
+            << 100.0 * cpu / elapsed << "%), RSS " << after.rssKiB << " KiB, peak RSS " << after.peakRssKiB << " KiB\n";
+}
+
+
+
+int main(int argc, char** argv)
+try {
+  const command_line cmdline{argc, argv};
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  auto variants = make_variants(cmdline.testDir);
+  auto dir      = write_config(cmdline);
+  auto daemon   = start_daemon(cmdline, dir);
+
+  try {
+    run_benchmark(cmdline, variants, daemon);
+  }
+  catch (...)
+  {
+    kill(daemon, SIGKILL);
+    waitpid(daemon, nullptr, 0);
+    throw;
+  }
+
+  kill(daemon, SIGTERM);
+  waitpid(daemon, nullptr, 0);
+  std::filesystem::remove_all(dir);
+
+  for (auto& variant: variants)
+    curl_slist_free_all(variant.headers);
+
+  curl_global_cleanup();
+  return 0;
+}
+catch (const std::exception& e)
+{
+  std::cerr << "gitlab-hook-bench: " << e.what() << "\n";
+  return 1;
+}
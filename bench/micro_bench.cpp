@@ -0,0 +1,324 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "action_list.h"
+#include "command_template.h"
+#include "config.h"
+#include "http_server.h"
+#include "io_context.h"
+#include "pipeline_hook.h"
+#include <arpa/inet.h>
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <nlohmann/json.hpp>
+#include <unistd.h>
+
+
+
+// Counting allocations of the whole program, reported per iteration.
+static std::uint64_t allocationCount{0};
+static std::uint64_t allocationBytes{0};
+
+
+void* operator new(std::size_t size)
+{
+  ++allocationCount;
+  allocationBytes += size;
+
+  if (auto p = std::malloc(size ? size : 1))
+    return p;
+
+  throw std::bad_alloc{};
+}
+
+
+void* operator new[](std::size_t size)
+{ return operator new(size); }
+
+
+void operator delete(void* p) noexcept
+{ std::free(p); }
+
+
+void operator delete[](void* p) noexcept
+{ std::free(p); }
+
+
+void operator delete(void* p, std::size_t) noexcept
+{ std::free(p); }
+
+
+void operator delete[](void* p, std::size_t) noexcept
+{ std::free(p); }
+
+
+
+/// Measures the allocations during a benchmark run.
+class allocation_counter
+{
+  public:
+    ~allocation_counter()
+    {
+      using benchmark::Counter;
+      mState.counters["allocs"] = Counter(static_cast<double>(allocationCount - mCount), Counter::kAvgIterations);
+      mState.counters["alloc_bytes"] = Counter(static_cast<double>(allocationBytes - mBytes), Counter::kAvgIterations);
+    }
+
+    explicit allocation_counter(benchmark::State& state) noexcept
+      : mState{state}
+    {}
+
+  private:
+    benchmark::State& mState;
+    std::uint64_t mCount{allocationCount};
+    std::uint64_t mBytes{allocationBytes};
+};
+
+
+
+/// The test pipeline event. If \a jobs is not zero, its builds are replaced
+/// by as many jobs named "job-N", every other one successful.
+static nlohmann::json pipeline_event(std::size_t jobs)
+{
+  std::ifstream in{TEST_SOURCE_DIR "/pipeline_event.json"};
+  auto event = nlohmann::json::parse(in);
+  if (!jobs)
+    return event;
+
+  auto prototype = event["builds"][0];
+  auto& builds   = event["builds"];
+  builds = nlohmann::json::array();
+
+  for (std::size_t i = 0; i != jobs; ++i)
+  {
+    auto job      = prototype;
+    job["id"]     = 1000 + i;
+    job["name"]   = "job-" + std::to_string(i);
+    job["status"] = i % 2 ? "failed" : "success";
+    builds.push_back(std::move(job));
+  }
+
+  return event;
+}
+
+
+
+static void json_parse(benchmark::State& state)
+{
+  auto text = pipeline_event(static_cast<std::size_t>(state.range(0))).dump();
+
+  allocation_counter counter{state};
+  for (auto _: state)
+    benchmark::DoNotOptimize(nlohmann::json::parse(text));
+
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * text.size()));
+}
+
+BENCHMARK(json_parse)->Arg(0)->Arg(10)->Arg(100)->Arg(1000);
+
+
+
+/// Exposes the event processing of pipeline_hook.
+struct bench_pipeline_hook : pipeline_hook
+{
+  using pipeline_hook::pipeline_hook;
+  using pipeline_hook::process;
+  using hook::event;
+};
+
+
+
+/// Writes a configuration file with a pipeline hook for \a jobs job names.
+static config::file pipeline_config(std::size_t jobs)
+{
+  char fileName[] = "/tmp/gitlab-hook-microbench.XXXXXX";
+  int fd = mkstemp(fileName);
+  close(fd);
+
+  std::ofstream out{fileName};
+  out << "[[hooks]]\n"
+      << "uri_path = \"/bench\"\n"
+      << "type = \"pipeline\"\n"
+      << "name = \"bench\"\n"
+      << "token = \"bench\"\n"
+      << "status = \"success\"\n"
+      << "command = \"/bin/true -x param\"\n"
+      << "job_name = [";
+  for (std::size_t i = 0; i != jobs; ++i)
+    out << (i ? ", " : "") << "\"job-" << i << "\"";
+  out << "]\n";
+
+  if (getuid() == 0)
+    out << "run_as = { user = \"nobody\" }\n";
+
+  out.close();
+  auto result = config::file::load(fileName);
+  unlink(fileName);
+  return result;
+}
+
+
+
+static void pipeline_hook_process(benchmark::State& state)
+{
+  auto jobs   = static_cast<std::size_t>(state.range(0));
+  auto config = pipeline_config(jobs);
+  auto json   = pipeline_event(jobs);
+
+  io_context io;
+  action_list actions{io};
+  bench_pipeline_hook hook{config["hooks"][0]};
+  bench_pipeline_hook::event event{"Pipeline Hook", json};
+
+  allocation_counter counter{state};
+  for (auto _: state)
+  {
+    hook.process(event);
+    action_list::remove_pending();
+  }
+}
+
+BENCHMARK(pipeline_hook_process)->Arg(10)->Arg(100)->Arg(1000);
+
+
+
+static void hook_to_string_ipv4(benchmark::State& state)
+{
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  inet_pton(AF_INET, "192.168.100.200", &addr.sin_addr);
+
+  allocation_counter counter{state};
+  for (auto _: state)
+    benchmark::DoNotOptimize(hook::to_string(reinterpret_cast<const sockaddr*>(&addr)));
+}
+
+BENCHMARK(hook_to_string_ipv4);
+
+
+
+static void hook_to_string_ipv6(benchmark::State& state)
+{
+  sockaddr_in6 addr{};
+  addr.sin6_family = AF_INET6;
+  inet_pton(AF_INET6, "2001:db8:85a3::8a2e:370:7334", &addr.sin6_addr);
+
+  allocation_counter counter{state};
+  for (auto _: state)
+    benchmark::DoNotOptimize(hook::to_string(reinterpret_cast<const sockaddr*>(&addr)));
+}
+
+BENCHMARK(hook_to_string_ipv6);
+
+
+
+static void command_template_expand(benchmark::State& state)
+{
+  command_template command{"/usr/local/bin/deploy.sh --ref {object_attributes.ref}\t--sha {env:CI_COMMIT_SHA} -x param"};
+  auto json = nlohmann::json::parse(R"({"object_attributes": {"ref": "main"}})");
+
+  process::environment environment;
+  environment.set("CI_COMMIT_SHA", "2f5c8a1e4b3d6f7a8c9e0b1d2f3a4c5e6b7d8f9a");
+
+  allocation_counter counter{state};
+  for (auto _: state)
+    benchmark::DoNotOptimize(command.expand(json, environment));
+}
+
+BENCHMARK(command_template_expand);
+
+
+
+static void environment_set_list(benchmark::State& state)
+{
+  std::vector<std::string> values;
+  for (int64_t i = 0; i != state.range(0); ++i)
+    values.push_back(std::to_string(100000 + i));
+
+  allocation_counter counter{state};
+  for (auto _: state)
+  {
+    process::environment environment;
+    environment.set_list("CI_JOB_IDS", values);
+    benchmark::DoNotOptimize(&environment);
+  }
+}
+
+BENCHMARK(environment_set_list)->Arg(1)->Arg(10)->Arg(100);
+
+
+
+static void environment_get(benchmark::State& state)
+{
+  process::environment environment;
+  for (int64_t i = 0; i != state.range(0); ++i)
+    environment.set("VARIABLE_" + std::to_string(i), "some value");
+
+  allocation_counter counter{state};
+  for (auto _: state)
+    benchmark::DoNotOptimize(environment.get());
+}
+
+BENCHMARK(environment_get)->Arg(10)->Arg(30);
+
+
+
+static void environment_per_request(benchmark::State& state)
+{
+  // The configured entries are shared, the per-request ones appended to one buffer.
+  auto base = std::make_shared<process::environment>();
+  for (int64_t i = 0; i != state.range(0); ++i)
+    base->set("CONFIGURED_" + std::to_string(i) + "=some value");
+
+  allocation_counter counter{state};
+  for (auto _: state)
+  {
+    process::environment environment;
+    environment.set("CI_PROJECT_ID", "4711");
+    environment.set("CI_PROJECT_PATH", "group/project");
+    environment.set("CI_COMMIT_SHA", "2d4c1b7a9f0e3d5c8b6a4f2e1d0c9b8a7f6e5d4c");
+    environment.set("CI_PIPELINE_ID", "123456");
+    environment.set_base(base);
+    benchmark::DoNotOptimize(environment.get());
+  }
+}
+
+BENCHMARK(environment_per_request)->Arg(0)->Arg(10);
+
+
+
+static void server_find_handler(benchmark::State& state)
+{
+  io_context io;
+  http::server server{io};
+  for (int64_t i = 0; i != state.range(0); ++i)
+    server.add_handler("/deploy/group/project-" + std::to_string(i), [](http::request) {});
+
+  auto path = "/deploy/group/project-" + std::to_string(state.range(0) / 2) + "/some/deep/sub/path";
+
+  allocation_counter counter{state};
+  for (auto _: state)
+    benchmark::DoNotOptimize(server.find_handler(path));
+}
+
+BENCHMARK(server_find_handler)->Arg(10)->Arg(100)->Arg(1000);
+
+
+
+BENCHMARK_MAIN();
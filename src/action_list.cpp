@@ -18,39 +18,54 @@
 #include "action_list.h"
 #include "io_context.h"
 #include "log.h"
+#include "metrics.h"
+#include "snapshot.h"
 #include <cassert>
 #include <event2/event.h>
 #include <list>
-
-
-
-struct free_event
-{
-  constexpr free_event() noexcept = default;
-
-  void operator()(event* p) noexcept
-  { event_free(p); }
-};
+#include <utility>
 
 
 
 struct action_list::item
 {
-  item(const char* n, process&& p, std::chrono::seconds t) noexcept
-    : name{n},
+  using clock = std::chrono::steady_clock;
+
+  item(std::size_t id, process&& p, std::chrono::seconds t, trace&& s, std::function<void(bool)>&& f) noexcept
+    : hookId{id},
       process{std::move(p)},
-      timeout{t}
+      timeout{t},
+      span{std::move(s)},
+      finished{std::move(f)}
   {}
 
-  item(const char* n, std::function<void()>&& f) noexcept
-    : name{n},
-      function{std::move(f)}
+  item(std::size_t id, std::function<void()>&& f, trace&& s) noexcept
+    : hookId{id},
+      function{std::move(f)},
+      span{std::move(s)}
   {}
 
-  const char* name;
+  hook_stats& stats() const noexcept
+  { return metrics::hook(hookId); }
+
+  const char* name() const noexcept
+  { return stats().name.c_str(); }
+
+  log_fields fields() const noexcept
+  {
+    auto result     = span.fields();
+    result.hookName = stats().name;
+    return result;
+  }
+
+  std::size_t hookId;
   std::function<void()> function;
   class process process;
   std::chrono::seconds timeout;
+  trace span;
+  std::function<void(bool)> finished;
+  clock::time_point appended{clock::now()};
+  clock::time_point started;
 };
 
 
@@ -64,25 +79,25 @@ struct action_list::impl
   std::unique_ptr<event,free_event> timeoutEv;
   std::unique_ptr<event,free_event> killEv;
   std::list<item> actions;
+  std::function<void()> idleHandler;
+  std::function<void()> pausedHandler;
+  bool executing{false};
+  bool paused{false};
 
   explicit impl(io_context& context) noexcept;
   ~impl();
 
   void executeProcess(item& action);
-  void executeFunction(item& action);
-  void finishExecuteAction() noexcept;
+  bool executeFunction(item& action);
+  void finishExecuteAction(bool succeeded) noexcept;
 
   static void executeNextAction(int, short, void* cls) noexcept;
   static void terminateCurrentAction(int, short, void* cls) noexcept;
   static void killCurrentAction(int, short, void* cls) noexcept;
-  static void addFailure() noexcept;
 };
 
 
 action_list::impl* action_list::impl::singleton = nullptr;
-size_t action_list::actionsExecuted{0};
-size_t action_list::actionsFailed{0};
-time_t action_list::actionFailTm{0};
 
 
 
@@ -94,9 +109,9 @@ action_list::action_list(io_context& context)
 
 action_list::impl::impl(io_context& context) noexcept
   : io{context},
-    execEv{event_new(io.native_handle(), -1, 0, &executeNextAction, this)},
-    timeoutEv{event_new(io.native_handle(), -1, EV_TIMEOUT, &terminateCurrentAction, this)},
-    killEv{event_new(io.native_handle(), -1, EV_TIMEOUT, &killCurrentAction, this)}
+    execEv{io.new_event<&executeNextAction>(-1, 0, this, "action_list::executeNextAction")},
+    timeoutEv{io.new_event<&terminateCurrentAction>(-1, EV_TIMEOUT, this, "action_list::terminateCurrentAction")},
+    killEv{io.new_event<&killCurrentAction>(-1, EV_TIMEOUT, this, "action_list::killCurrentAction")}
 {
   assert(!singleton);
   singleton = this;
@@ -115,7 +130,7 @@ action_list::impl::~impl()
   {
     log_warning("%zu pending hook(s) will not be executed/completed:", actions.size());
     for (const auto& action: actions)
-      log_warning("* %s", action.name);
+      log_warning("* %s", action.name());
   }
 
   singleton = nullptr;
@@ -123,51 +138,178 @@ action_list::impl::~impl()
 
 
 
+size_t action_list::size() noexcept
+{ return impl::singleton->actions.size(); }
+
+
+size_t action_list::running() noexcept
+{ return impl::singleton->executing ? 1 : 0; }
+
+
 io_context& action_list::get_io_context() noexcept
 { return impl::singleton->io; }
 
 
 
-void action_list::append(const char* name, process process, std::chrono::seconds timeout)
+void action_list::append(std::size_t hookId, process process, std::chrono::seconds timeout, trace span,
+                         std::function<void(bool)> finished)
 {
   auto self = impl::singleton;
   assert(self);
 
-  self->actions.emplace_back(name, std::move(process), timeout);
+  self->actions.emplace_back(hookId, std::move(process), timeout, std::move(span), std::move(finished));
   if (self->actions.size() == 1)
     event_active(self->execEv.get(), 0, 0);
 }
 
 
 
-void action_list::append(const char* name, std::function<void()> function)
+void action_list::append(std::size_t hookId, std::function<void()> function, trace span)
 {
   auto self = impl::singleton;
   assert(self);
 
-  self->actions.emplace_back(name, std::move(function));
+  self->actions.emplace_back(hookId, std::move(function), std::move(span));
   if (self->actions.size() == 1)
     event_active(self->execEv.get(), 0, 0);
 }
 
 
 
-void action_list::impl::executeNextAction(int, short, void* cls) noexcept
+void action_list::save_pending(snapshot_writer& out)
 {
-  auto  self   = static_cast<impl*>(cls);
-  auto& action = self->actions.front();
+  auto self  = impl::singleton;
+  auto begin = self->actions.begin();
+  if (self->executing)
+    ++begin;
+
+  for (auto iter = begin; iter != self->actions.end(); ++iter)
+    if (iter->process)
+    {
+      out.put(std::string_view{iter->name()});
+      out.put(static_cast<std::uint64_t>(iter->timeout.count()));
+      iter->process.save(out);
+    }
+}
+
+
 
-  log_info("executing hook '%s'", action.name);
-  fflush(stderr);
+void action_list::remove_pending() noexcept
+{
+  auto self  = impl::singleton;
+  auto begin = self->actions.begin();
+  if (self->executing)
+    ++begin;
+
+  for (auto iter = begin; iter != self->actions.end();)
+    if (iter->process)
+      iter = self->actions.erase(iter);
+    else
+      ++iter;
 
-  if (action.process)
-    self->executeProcess(action);
-  else if (action.function)
-    self->executeFunction(action);
+  if (self->actions.empty() && self->idleHandler)
+    std::exchange(self->idleHandler, nullptr)();
+}
+
+
+
+void action_list::restore(snapshot_reader& in)
+{
+  auto self = impl::singleton;
+  assert(self);
+
+  while (!in.at_end())
+  {
+    auto name    = in.get_string();
+    auto timeout = std::chrono::seconds{in.get_uint()};
+
+    class process process{self->io};
+    process.restore(in);
+
+    self->actions.emplace_back(metrics::hook_id(name), std::move(process), timeout, trace{}, nullptr);
+    if (self->actions.size() == 1)
+      event_active(self->execEv.get(), 0, 0);
+
+    log_info("took over pending hook '%s'", self->actions.back().name());
+  }
+}
+
+
+
+void action_list::when_idle(std::function<void()> handler)
+{
+  auto self = impl::singleton;
+  assert(self);
+
+  if (self->actions.empty())
+    handler();
   else
-    assert(false);
+    self->idleHandler = std::move(handler);
+}
 
-  ++actionsExecuted;
+
+
+void action_list::pause(std::function<void()> handler)
+{
+  auto self = impl::singleton;
+  assert(self);
+
+  self->paused = true;
+  if (self->executing)
+    self->pausedHandler = std::move(handler);
+  else
+    handler();
+}
+
+
+
+void action_list::resume() noexcept
+{
+  auto self = impl::singleton;
+  assert(self);
+
+  self->paused        = false;
+  self->pausedHandler = nullptr;
+  if (self->executing)
+    return;
+
+  if (!self->actions.empty())
+    event_active(self->execEv.get(), 0, 0);
+  else if (self->idleHandler)
+    std::exchange(self->idleHandler, nullptr)();
+}
+
+
+
+void action_list::impl::executeNextAction(int, short, void* cls) noexcept
+{
+  auto self = static_cast<impl*>(cls);
+  if (self->actions.empty() || self->paused)
+    return;  // pending actions were removed meanwhile, or will be executed after resume()
+
+  // The scope ends before finishExecuteAction() removes the action its fields refer to.
+  bool succeeded;
+  auto& action = self->actions.front();
+  {
+    auto fields = action.fields();
+    log_scope scope{fields};
+    io_context::set_subject(action.name());
+    log_info("executing hook '%s'", action.name());
+
+    self->executing = true;
+    action.started  = item::clock::now();
+    action.span.mark(trace::stage::process_started);
+    metrics::queueWaitTime.observe(action.started - action.appended);
+    action.stats().action_started(action.started - action.appended);
+
+    if (action.process)
+      return self->executeProcess(action);
+
+    assert(action.function);
+    succeeded = self->executeFunction(action);
+  }
+
+  self->finishExecuteAction(succeeded);
 }
 
 
@@ -182,18 +324,22 @@ void action_list::impl::executeProcess(item& action)
     fputs("--------------------------------------------------------------------------------\n", stdout);
     fflush(stdout);
 
-    auto& action = actions.front();
-    if (error)
-      log_error("hook '%s': %s", action.name, error.message().c_str());  // hope that message() does not throw
-    else if (exitCode != 0)
-      log_error("hook '%s': exited with code %i", action.name, exitCode);
-    else
-      log_info("completed hook '%s'", action.name);
-
-    if (error || exitCode != 0)
-      addFailure();
-
-    finishExecuteAction();
+    {
+      auto& action = actions.front();
+      auto  fields = action.fields();
+      fields.duration = std::chrono::duration_cast<std::chrono::microseconds>(item::clock::now() - action.started);
+
+      log_scope scope{fields};
+      io_context::set_subject(action.name());
+      if (error)
+        log_error("hook '%s': %s", action.name(), error.message().c_str());  // hope that message() does not throw
+      else if (exitCode != 0)
+        log_error("hook '%s': exited with code %i", action.name(), exitCode);
+      else
+        log_info("completed hook '%s'", action.name());
+    }
+
+    finishExecuteAction(!error && exitCode == 0);
   });
 
   timeval tm{};
@@ -203,28 +349,66 @@ void action_list::impl::executeProcess(item& action)
 
 
 
-void action_list::impl::executeFunction(item& action)
+bool action_list::impl::executeFunction(item& action)
 {
   try {
     action.function();
-    log_info("completed hook '%s'", action.name);
+    log_info("completed hook '%s'", action.name());
+    return true;
   }
   catch (const std::exception& e)
   {
-    log_error("hook '%s': %s", action.name, e.what());
-    addFailure();
+    log_error("hook '%s': %s", action.name(), e.what());
+    return false;
   }
-
-  finishExecuteAction();
 }
 
 
 
-void action_list::impl::finishExecuteAction() noexcept
+void action_list::impl::finishExecuteAction(bool succeeded) noexcept
 {
+  {
+    auto& action   = actions.front();
+    auto  duration = item::clock::now() - action.started;
+    auto  fields   = action.fields();
+    log_scope scope{fields};
+
+    metrics::actionRunTime.observe(duration);
+    action.stats().action_finished(duration, succeeded);
+
+    action.span.mark(trace::stage::process_exited);
+    try {
+      action.span.finish(succeeded ? "succeeded" : "failed");
+    }
+    catch (const std::exception& e)
+    {
+      log_error("failed to write trace: %s", e.what());
+    }
+
+    if (action.finished)
+    {
+      try {
+        action.finished(succeeded);
+      }
+      catch (const std::exception& e)
+      {
+        log_error("hook '%s': %s", action.name(), e.what());
+      }
+    }
+  }
+
+  executing = false;
   actions.pop_front();
-  if (!actions.empty())
+
+  if (paused)
+  {
+    if (pausedHandler)
+      std::exchange(pausedHandler, nullptr)();
+  }
+  else if (!actions.empty())
     event_active(execEv.get(), 0, 0);
+  else if (idleHandler)
+    std::exchange(idleHandler, nullptr)();
 }
 
 
@@ -233,8 +417,12 @@ void action_list::impl::terminateCurrentAction(int, short, void* cls) noexcept
 {
   auto  self   = static_cast<impl*>(cls);
   auto& action = self->actions.front();
+  auto  fields = action.fields();
+  log_scope scope{fields};
+  io_context::set_subject(action.name());
 
-  log_error("hook '%s': timed out", action.name);
+  log_error("hook '%s': timed out", action.name());
+  ++action.stats().timedOut;
   action.process.terminate();
 
   timeval tm{};
@@ -246,21 +434,16 @@ void action_list::impl::terminateCurrentAction(int, short, void* cls) noexcept
 
 void action_list::impl::killCurrentAction(int, short, void* cls) noexcept
 {
-  auto  self   = static_cast<impl*>(cls);
-  auto& action = self->actions.front();
-
-  log_error("hook '%s': killing process", action.name);
-  action.process.kill();
-
-  self->actions.pop_front();
-  if (!self->actions.empty())
-    event_active(self->execEv.get(), 0, 0);
-}
-
+  auto self = static_cast<impl*>(cls);
+  {
+    auto& action = self->actions.front();
+    auto  fields = action.fields();
+    log_scope scope{fields};
+    io_context::set_subject(action.name());
 
+    log_error("hook '%s': killing process", action.name());
+    action.process.kill();
+  }
 
-inline void action_list::impl::addFailure() noexcept
-{
-  ++actionsFailed;
-  actionFailTm = std::time(nullptr);
+  self->finishExecuteAction(false);
 }
@@ -17,9 +17,12 @@
 */
 #pragma once
 #include "process.h"
+#include "trace.h"
 #include <chrono>
 #include <memory>
 class io_context;
+class snapshot_reader;
+class snapshot_writer;
 
 
 
@@ -31,28 +34,49 @@ class action_list
     /// Constructs the global action list singleton.
     explicit action_list(io_context& context);
 
-    /// The number of hooks executed since start of the program.
-    static size_t executedCount() noexcept
-    { return actionsExecuted; }
+    /// The number of actions in the list, including the one executing.
+    static size_t size() noexcept;
 
-    /// The number of failed hooks since start of the program.
-    static size_t failedCount() noexcept
-    { return actionsFailed; }
-
-    /// Time when the last hook failed.
-    static time_t lastFailure() noexcept
-    { return actionFailTm; }
+    /// The number of actions currently executing, 0 or 1.
+    static size_t running() noexcept;
 
     /// The I/O context that must be used for constructing process objects.
     static io_context& get_io_context() noexcept;
 
-    /// Appends a new \a process to be executed to the global list, with the
-    /// hook \a name for logging purposes.
-    static void append(const char* name, process process, std::chrono::seconds timeout);
+    /// Appends a new \a process to be executed to the global list, on behalf
+    /// of the hook with given \a hookId, see metrics::hook_id(). The \a span
+    /// is completed and written when the process exits, and \a finished is
+    /// invoked with whether it succeeded. Processes handed over to another
+    /// instance, see save_pending(), lose their \a finished handler.
+    static void append(std::size_t hookId, process process, std::chrono::seconds timeout, trace span = {},
+                       std::function<void(bool)> finished = {});
+
+    /// Appends a new \a function to be executed to the global list, on behalf
+    /// of the hook with given \a hookId, see metrics::hook_id(). The \a span
+    /// is completed and written when the function returns.
+    static void append(std::size_t hookId, std::function<void()> function, trace span = {});
+
+    /// Writes the pending processes to \a out, that is, all processes in the
+    /// list except the one currently executing. Functions are not included.
+    static void save_pending(snapshot_writer& out);
+
+    /// Removes the processes written by save_pending() from the list.
+    static void remove_pending() noexcept;
 
-    /// Appends a new \a function to be executed to the global list, with the
-    /// hook \a name for logging purposes.
-    static void append(const char* name, std::function<void()> function);
+    /// Appends the processes written by save_pending() from \a in to the
+    /// global list.
+    static void restore(snapshot_reader& in);
+
+    /// Invokes the \a handler once, as soon as the list is empty.
+    static void when_idle(std::function<void()> handler);
+
+    /// Stops executing actions from the list, and invokes the \a handler
+    /// once, as soon as the action currently executing finished. Then
+    /// save_pending() covers all processes in the list.
+    static void pause(std::function<void()> handler);
+
+    /// Continues executing actions after pause().
+    static void resume() noexcept;
 
   private:
     struct item;
@@ -63,9 +87,5 @@ class action_list
       void operator()(impl* p) noexcept;
     };
 
-    static size_t actionsExecuted;
-    static size_t actionsFailed;
-    static time_t actionFailTm;
-
     std::unique_ptr<impl,impl_delete> m;
 };
@@ -0,0 +1,458 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "capture.h"
+#include "http_server.h"
+#include "log.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <strings.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+using namespace std::chrono_literals;
+
+
+
+/// The pending records are written when they exceed this size, or one second
+/// after the first of them was appended.
+constexpr std::size_t batchSize = 256 * 1024;
+
+/// Requests are dropped while this much data is pending.
+constexpr std::size_t maxPending = 16 * 1024 * 1024;
+
+constexpr std::string_view redacted{"[redacted]"};
+
+
+
+struct capture_file::impl
+{
+  static impl* singleton;
+
+  std::string fileName;
+  std::size_t maxSize;
+  unsigned maxFiles;
+  bool redactTokens;
+
+  int fd{-1};
+  std::size_t fileSize{0};
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::string pending;
+  std::size_t dropped{0};
+  std::string error;     ///< set by the writer thread, logged by the event loop
+  bool stopping{false};
+  std::thread writer;
+
+  impl(const std::string& fileName, std::size_t maxSize, unsigned maxFiles, bool redactTokens);
+  ~impl();
+
+  void open();
+  void rotate();
+  void write(std::string_view data);
+  void run();
+  void fail(const std::string& message);
+};
+
+
+capture_file::impl* capture_file::impl::singleton = nullptr;
+
+
+
+static void put_u32(std::string& out, std::size_t value)
+{
+  auto v = static_cast<std::uint32_t>(value);
+  char bytes[4] = {static_cast<char>(v), static_cast<char>(v >> 8), static_cast<char>(v >> 16), static_cast<char>(v >> 24)};
+  out.append(bytes, sizeof(bytes));
+}
+
+
+static void put_u64(std::string& out, std::uint64_t value)
+{
+  put_u32(out, static_cast<std::uint32_t>(value));
+  put_u32(out, static_cast<std::uint32_t>(value >> 32));
+}
+
+
+static void put_string(std::string& out, std::string_view value)
+{
+  put_u32(out, value.size());
+  out.append(value);
+}
+
+
+static bool is_token_header(std::string_view name) noexcept
+{
+  auto equals = [name](std::string_view other)
+  { return name.size() == other.size() && strncasecmp(name.data(), other.data(), name.size()) == 0; };
+
+  return equals("X-Gitlab-Token") || equals("Authorization");
+}
+
+
+
+capture_file::capture_file(const std::string& fileName, std::size_t maxSize, unsigned maxFiles, bool redactTokens)
+  : m{new impl{fileName, maxSize, maxFiles, redactTokens}}
+{}
+
+
+capture_file::~capture_file()
+= default;
+
+
+void capture_file::impl_delete::operator()(impl* p) noexcept
+{ delete p; }
+
+
+
+capture_file::impl::impl(const std::string& fileName, std::size_t maxSize, unsigned maxFiles, bool redactTokens)
+  : fileName{fileName},
+    maxSize{maxSize},
+    maxFiles{std::max(maxFiles, 1u)},
+    redactTokens{redactTokens}
+{
+  open();
+  writer = std::thread{[this] { run(); }};
+
+  assert(!singleton);
+  singleton = this;
+}
+
+
+
+capture_file::impl::~impl()
+{
+  singleton = nullptr;
+
+  {
+    std::lock_guard lock{mutex};
+    stopping = true;
+  }
+
+  wakeup.notify_one();
+  writer.join();
+  if (fd != -1)
+    close(fd);
+}
+
+
+
+void capture_file::append(const http::request& request, std::string_view peer)
+{
+  auto self = impl::singleton;
+  if (!self)
+    return;
+
+  auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+  std::unique_lock lock{self->mutex};
+  if (self->pending.size() >= maxPending)
+  {
+    ++self->dropped;
+    return;
+  }
+
+  // The log may only be written by the event loop.
+  auto dropped = std::exchange(self->dropped, 0);
+  auto error   = std::exchange(self->error, {});
+  if (dropped || !error.empty())
+  {
+    lock.unlock();
+    if (dropped)
+      log_warning("capture file cannot keep up, dropped %zu requests", dropped);
+
+    if (!error.empty())
+      log_error("%s", error.c_str());
+
+    lock.lock();
+  }
+
+  auto& out   = self->pending;
+  auto  start = out.size();
+  put_u32(out, 0);
+  put_u64(out, static_cast<std::uint64_t>(time.count()));
+  put_string(out, peer);
+  put_string(out, request.path());
+
+  auto countPos = out.size();
+  std::size_t count = 0;
+  put_u32(out, 0);
+  request.for_each_header([&out, &count, self](std::string_view name, std::string_view value)
+  {
+    put_string(out, name);
+    put_string(out, self->redactTokens && is_token_header(name) ? redacted : value);
+    ++count;
+  });
+
+  put_string(out, request.content());
+
+  // Fill in the record size and header count.
+  std::string prefix;
+  put_u32(prefix, out.size() - start - 4);
+  out.replace(start, 4, prefix);
+
+  prefix.clear();
+  put_u32(prefix, count);
+  out.replace(countPos, 4, prefix);
+
+  bool full = start < batchSize && out.size() >= batchSize;
+  lock.unlock();
+
+  if (full)
+    self->wakeup.notify_one();
+}
+
+
+
+void capture_file::impl::open()
+{
+  fd = ::open(fileName.c_str(), O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0640);
+  if (fd == -1)
+    throw std::system_error{errno, std::system_category(), "failed to open capture file " + fileName};
+
+  struct stat info;
+  if (fstat(fd, &info) == -1)
+  {
+    auto error = errno;
+    close(fd);
+    fd = -1;
+    throw std::system_error{error, std::system_category(), "failed to read size of capture file " + fileName};
+  }
+
+  fileSize = static_cast<std::size_t>(info.st_size);
+  if (fileSize == 0)
+    write(magic);
+}
+
+
+
+void capture_file::impl::rotate()
+{
+  close(fd);
+  fd = -1;
+
+  for (auto i = maxFiles - 1; i > 0; --i)
+  {
+    auto from = i == 1 ? fileName : fileName + '.' + std::to_string(i - 1);
+    auto to   = fileName + '.' + std::to_string(i);
+    if (std::rename(from.c_str(), to.c_str()) == -1 && errno != ENOENT)
+      fail("failed to rename capture file " + from + ": " + strerror(errno));
+  }
+
+  if (maxFiles == 1 && unlink(fileName.c_str()) == -1 && errno != ENOENT)
+    fail("failed to remove capture file " + fileName + ": " + strerror(errno));
+
+  open();
+}
+
+
+
+void capture_file::impl::write(std::string_view data)
+{
+  fileSize += data.size();
+  while (!data.empty())
+  {
+    auto written = ::write(fd, data.data(), data.size());
+    if (written == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      fail(std::string{"failed to write capture file: "} + strerror(errno));
+      return;
+    }
+
+    data.remove_prefix(static_cast<std::size_t>(written));
+  }
+}
+
+
+
+void capture_file::impl::run()
+{
+  std::string batch;
+  std::unique_lock lock{mutex};
+
+  for (;;)
+  {
+    wakeup.wait(lock, [this] { return stopping || !pending.empty(); });
+    wakeup.wait_for(lock, 1s, [this] { return stopping || pending.size() >= batchSize; });
+
+    batch.swap(pending);
+    bool stop = stopping;
+    lock.unlock();
+
+    // Rotate between batches only, so that records are never split. If the
+    // file could not be opened, the batch is lost, and the next one retries.
+    if (!batch.empty())
+    {
+      try {
+        if (fd == -1)
+          open();
+        else if (fileSize > magic.size() && fileSize + batch.size() > maxSize)
+          rotate();
+
+        write(batch);
+      }
+      catch (const std::exception& e)
+      {
+        fail(e.what());
+      }
+
+      batch.clear();
+    }
+
+    if (stop)
+      return;
+
+    lock.lock();
+  }
+}
+
+
+
+void capture_file::impl::fail(const std::string& message)
+{
+  std::lock_guard lock{mutex};
+  if (error.empty())
+    error = message;
+}
+
+
+
+std::string_view captured_request::header(std::string_view name) const noexcept
+{
+  for (auto& [key, value]: headers)
+    if (key.size() == name.size() && strncasecmp(key.data(), name.data(), name.size()) == 0)
+      return value;
+
+  return {};
+}
+
+
+
+capture_reader::capture_reader(const std::string& fileName)
+  : mFileName{fileName},
+    mIn{fileName, std::ios::binary}
+{
+  if (!mIn)
+    throw std::system_error{errno, std::system_category(), "failed to open capture file " + fileName};
+
+  char magic[capture_file::magic.size()];
+  if (!mIn.read(magic, sizeof(magic)) || std::string_view{magic, sizeof(magic)} != capture_file::magic)
+    throw std::runtime_error{fileName + " is not a capture file"};
+}
+
+
+
+/// Decodes the fields of a capture record.
+class record_parser
+{
+  public:
+    explicit record_parser(std::string_view record) noexcept
+      : mData{record}
+    {}
+
+    std::uint32_t u32()
+    {
+      auto bytes = take(4);
+      std::uint32_t result = 0;
+      for (int i = 3; i >= 0; --i)
+        result = (result << 8) | static_cast<unsigned char>(bytes[static_cast<std::size_t>(i)]);
+
+      return result;
+    }
+
+    std::uint64_t u64()
+    {
+      auto low = u32();
+      return low | (std::uint64_t{u32()} << 32);
+    }
+
+    std::string_view string()
+    { return take(u32()); }
+
+    bool at_end() const noexcept
+    { return mData.empty(); }
+
+  private:
+    std::string_view take(std::size_t size)
+    {
+      if (size > mData.size())
+        throw std::runtime_error{"corrupt record in capture file"};
+
+      auto result = mData.substr(0, size);
+      mData.remove_prefix(size);
+      return result;
+    }
+
+    std::string_view mData;
+};
+
+
+
+bool capture_reader::next(captured_request& request)
+{
+  char sizeBytes[4];
+  if (!mIn.read(sizeBytes, sizeof(sizeBytes)))
+  {
+    if (mIn.gcount())
+      log_warning("incomplete record at end of capture file %s", mFileName.c_str());
+
+    return false;
+  }
+
+  auto size = record_parser{{sizeBytes, sizeof(sizeBytes)}}.u32();
+  mRecord.resize(size);
+  if (!mIn.read(mRecord.data(), size))
+  {
+    log_warning("incomplete record at end of capture file %s", mFileName.c_str());
+    return false;
+  }
+
+  record_parser in{mRecord};
+  request.time = std::chrono::system_clock::time_point{std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds{in.u64()})};
+  request.peer = in.string();
+  request.path = in.string();
+
+  auto headerCount = in.u32();
+  if (headerCount > size / 8)
+    throw std::runtime_error{"corrupt record in capture file " + mFileName};
+
+  request.headers.resize(headerCount);
+  for (auto& [name, value]: request.headers)
+  {
+    name  = in.string();
+    value = in.string();
+  }
+
+  request.body = in.string();
+  if (!in.at_end())
+    throw std::runtime_error{"corrupt record in capture file " + mFileName};
+
+  return true;
+}
@@ -0,0 +1,111 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+namespace http { class request; }
+
+
+
+/// A file to which received webhook requests are appended, for replaying
+/// them later. The file starts with the 8 bytes "GLHCAP1\n", followed by one
+/// record per request. All integers are little-endian:
+///
+///     u32 size of the rest of the record
+///     u64 time of arrival, in nanoseconds since the Unix epoch
+///     u32 length, peer address
+///     u32 length, URI-Path
+///     u32 number of headers, each: u32 length, name; u32 length, value
+///     u32 length, body
+///
+/// Records are collected and written by a background thread in batches, at
+/// most one second after the request. When the file exceeds the maximum size,
+/// it is renamed with suffix ".1", older files are shifted to ".2" and so on,
+/// and a new file is started.
+class capture_file
+{
+  public:
+    /// The first bytes of a capture file.
+    static constexpr std::string_view magic{"GLHCAP1\n"};
+
+    /// Opens the capture file with given \a fileName for appending, rotating
+    /// it when it would exceed \a maxSize bytes, and keeping \a maxFiles files
+    /// including the current one. If \a redactTokens is set, the values of the
+    /// X-Gitlab-Token and Authorization headers are replaced by "[redacted]".
+    capture_file(const std::string& fileName, std::size_t maxSize, unsigned maxFiles, bool redactTokens);
+
+    /// Writes the pending records and closes the file.
+    ~capture_file();
+
+    /// Appends the \a request from the \a peer, whose content has been
+    /// received, to the capture file, if there is one. Drops the request if
+    /// the background thread cannot keep up.
+    static void append(const http::request& request, std::string_view peer);
+
+  private:
+    struct impl;
+    struct impl_delete
+    {
+      constexpr impl_delete() noexcept = default;
+      void operator()(impl* p) noexcept;
+    };
+
+    std::unique_ptr<impl,impl_delete> m;
+};
+
+
+
+/// A request read from a capture file.
+struct captured_request
+{
+  std::chrono::system_clock::time_point time;
+  std::string peer;
+  std::string path;
+  std::vector<std::pair<std::string,std::string>> headers;
+  std::string body;
+
+  /// The value of the header with given \a name, which is compared case
+  /// insensitively. Returns an empty string if not present.
+  std::string_view header(std::string_view name) const noexcept;
+};
+
+
+
+/// Reads the requests from a file written by capture_file.
+class capture_reader
+{
+  public:
+    /// Opens the capture file with given \a fileName. Throws if it cannot be
+    /// opened or is not a capture file.
+    explicit capture_reader(const std::string& fileName);
+
+    /// Reads the next \a request. Returns false at the end of the file, or if
+    /// the last record is incomplete. Throws if the file is corrupt.
+    bool next(captured_request& request);
+
+  private:
+    std::string mFileName;
+    std::ifstream mIn;
+    std::string mRecord;
+};
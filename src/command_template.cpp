@@ -0,0 +1,329 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "command_template.h"
+#include <algorithm>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+
+
+/// Parses a command into the parts of a command_template.
+class command_template::parser
+{
+  public:
+    parser(command_template& result, std::string_view command) noexcept
+      : mResult{result},
+        mCommand{command},
+        mText{command}
+    {}
+
+    void parse()
+    {
+      for (;;)
+      {
+        while (!mText.empty() && (mText.front() == ' ' || mText.front() == '\t'))
+          mText.remove_prefix(1);
+
+        if (mText.empty())
+          break;
+
+        bool program = mResult.mParts.empty();
+        argument();
+        if (program && std::any_of(mResult.mParts.begin(), mResult.mParts.end(), [](const part& p)
+            { return p.kind != part::literal; }))
+          fail("the program must not contain placeholders");
+
+        add({part::end_argument});
+      }
+    }
+
+  private:
+    [[noreturn]] void fail(const char* reason) const
+    {
+      throw std::runtime_error{"invalid command '" + std::string{mCommand} + "' at position "
+                               + std::to_string(mCommand.size() - mText.size()) + ": " + reason};
+    }
+
+    char take()
+    {
+      char c = mText.front();
+      mText.remove_prefix(1);
+      return c;
+    }
+
+    void add(part p)
+    { mResult.mParts.push_back(p); }
+
+    void literal(char c)
+    {
+      auto& parts = mResult.mParts;
+      if (parts.empty() || parts.back().kind != part::literal)
+        add({part::literal, mResult.mText.size()});
+
+      mResult.mText.push_back(c);
+      ++parts.back().size;
+    }
+
+    void escaped()
+    {
+      if (mText.empty())
+        fail("backslash at the end");
+
+      literal(take());
+    }
+
+    void argument()
+    {
+      // An empty quoted argument still counts.
+      add({part::literal, mResult.mText.size()});
+
+      while (!mText.empty() && mText.front() != ' ' && mText.front() != '\t')
+      {
+        char c = take();
+        switch (c)
+        {
+          case '\\': escaped(); break;
+          case '{':  placeholder(); break;
+          case '}':  fail("unmatched '}', use \\} for a literal brace");
+
+          case '\'':
+            for (;;)
+            {
+              if (mText.empty())
+                fail("missing closing single quote");
+
+              if ((c = take()) == '\'')
+                break;
+
+              literal(c);
+            }
+            break;
+
+          case '"':
+            for (;;)
+            {
+              if (mText.empty())
+                fail("missing closing double quote");
+
+              c = take();
+              if (c == '"')
+                break;
+              else if (c == '\\')
+                escaped();
+              else if (c == '{')
+                placeholder();
+              else if (c == '}')
+                fail("unmatched '}', use \\} for a literal brace");
+              else
+                literal(c);
+            }
+            break;
+
+          default:
+            literal(c);
+            break;
+        }
+      }
+    }
+
+    void placeholder()
+    {
+      auto end = mText.find('}');
+      if (end == mText.npos)
+        fail("missing closing brace");
+
+      auto name = mText.substr(0, end);
+      if (name.starts_with("env:"))
+      {
+        name.remove_prefix(4);
+        if (name.empty())
+          fail("empty environment variable name");
+
+        add({part::env, mResult.mText.size(), name.size()});
+        mResult.mText.append(name);
+      }
+      else
+      {
+        std::vector<segment> path;
+        for (;;)
+        {
+          auto dot  = name.find('.');
+          auto text = name.substr(0, dot);
+          if (text.empty())
+            fail("empty name in placeholder");
+
+          bool isIndex = text.size() < 10 && (text == "0" || text.front() != '0')
+                         && text.find_first_not_of("0123456789") == text.npos;
+          path.push_back({std::string{text}, isIndex ? std::stoul(std::string{text}) : std::string::npos});
+
+          if (dot == name.npos)
+            break;
+
+          name.remove_prefix(dot + 1);
+        }
+
+        add({part::json, mResult.mPaths.size()});
+        mResult.mPaths.push_back(std::move(path));
+      }
+
+      mText.remove_prefix(end + 1);
+    }
+
+    command_template& mResult;
+    std::string_view mCommand;
+    std::string_view mText;
+};
+
+
+
+command_template::command_template(std::string_view command)
+{
+  parser{*this, command}.parse();
+
+  bool placeholders = false;
+  for (auto& p: mParts)
+    placeholders |= p.kind == part::json || p.kind == part::env;
+
+  if (placeholders || mParts.empty())
+    return;
+
+  auto commandLine = std::make_shared<process::command_line>();
+  for (auto& p: mParts)
+    if (p.kind == part::end_argument)
+      commandLine->add({});
+    else
+      commandLine->append(std::string_view{mText}.substr(p.offset, p.size));
+
+  mCommandLine = std::move(commandLine);
+  mParts.clear();
+  mPaths.clear();
+  mText.clear();
+}
+
+
+
+std::shared_ptr<const process::command_line> command_template::expand(const nlohmann::json& json, const process::environment& environment) const
+{
+  if (mCommandLine)
+    return mCommandLine;
+
+  auto result = std::make_shared<process::command_line>();
+  for (auto& p: mParts)
+    switch (p.kind)
+    {
+      case part::literal:
+        result->append(std::string_view{mText}.substr(p.offset, p.size));
+        break;
+
+      case part::env:
+        result->append(environment.value(std::string_view{mText}.substr(p.offset, p.size)));
+        break;
+
+      case part::json:
+      {
+        auto value = lookup(json, mPaths[p.offset]);
+        if (!value)
+          break;
+        else if (value->is_string())
+          result->append(value->get_ref<const std::string&>());
+        else
+          result->append(value->dump());
+        break;
+      }
+
+      case part::end_argument:
+        result->add({});
+        break;
+    }
+
+  return result;
+}
+
+
+
+std::shared_ptr<const process::command_line> command_template::expand(const process::environment& environment) const
+{
+  static const nlohmann::json none;
+  return expand(none, environment);
+}
+
+
+
+command_template command_template::bind(const nlohmann::json& json) const
+{
+  if (mCommandLine)
+    return *this;
+
+  command_template result;
+  auto add = [&result](part::kind_type kind, std::string_view text)
+  {
+    result.mParts.push_back({kind, result.mText.size(), text.size()});
+    result.mText.append(text);
+  };
+
+  for (auto& p: mParts)
+    switch (p.kind)
+    {
+      case part::literal:
+      case part::env:
+        add(p.kind, std::string_view{mText}.substr(p.offset, p.size));
+        break;
+
+      case part::json:
+      {
+        auto value = lookup(json, mPaths[p.offset]);
+        if (!value)
+          break;
+        else if (value->is_string())
+          add(part::literal, value->get_ref<const std::string&>());
+        else
+          add(part::literal, value->dump());
+        break;
+      }
+
+      case part::end_argument:
+        result.mParts.push_back({part::end_argument});
+        break;
+    }
+
+  return result;
+}
+
+
+
+const nlohmann::json* command_template::lookup(const nlohmann::json& json, const std::vector<segment>& path) noexcept
+{
+  auto value = &json;
+  for (auto& segment: path)
+  {
+    if (value->is_object())
+    {
+      auto iter = value->find(segment.name);
+      value = iter != value->end() ? &*iter : nullptr;
+    }
+    else if (value->is_array() && segment.index < value->size())
+      value = &(*value)[segment.index];
+    else
+      value = nullptr;
+
+    if (!value)
+      break;
+  }
+
+  return value && !value->is_null() ? value : nullptr;
+}
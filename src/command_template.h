@@ -0,0 +1,97 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "process.h"
+#include <memory>
+#include <nlohmann/json_fwd.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+
+/// The command of a hook, parsed once into program and arguments, with
+/// placeholders that are replaced by values of each event. No shell is
+/// involved. The quoting rules are:
+///
+/// - Arguments are separated by spaces and tabs outside of quotes.
+/// - Within single quotes `'...'`, all characters are taken literally.
+/// - Within double quotes `"..."`, spaces and tabs are taken literally, and
+///   a backslash takes the next character literally.
+/// - Outside of quotes, a backslash takes the next character literally.
+/// - Outside of single quotes, `{name.name...}` is replaced by the value at
+///   that path in the event's json content, where names of array elements
+///   are their indexes, and `{env:NAME}` by the value of the environment
+///   variable NAME of the command. Strings are inserted as they are, other
+///   values as json, and missing values as empty strings.
+/// - A placeholder never splits an argument, whatever its value contains.
+///
+/// The program must be given with full path, and must not contain
+/// placeholders.
+class command_template
+{
+  public:
+    /// Constructs an empty command.
+    command_template() = default;
+
+    /// Parses the \a command. Throws if it is invalid.
+    explicit command_template(std::string_view command);
+
+    /// Whether the command is empty.
+    bool empty() const noexcept
+    { return !mCommandLine && mParts.empty(); }
+
+    /// The command line for the event with the \a json content and the
+    /// process \a environment. Shared by all events if the command has no
+    /// placeholders.
+    std::shared_ptr<const process::command_line> expand(const nlohmann::json& json, const process::environment& environment) const;
+
+    /// The command line for the process \a environment, for a command whose
+    /// json placeholders are already replaced, see bind().
+    std::shared_ptr<const process::command_line> expand(const process::environment& environment) const;
+
+    /// The command with the json placeholders replaced by the values of the
+    /// event with the \a json content, and the environment placeholders kept,
+    /// for an environment that is completed later.
+    command_template bind(const nlohmann::json& json) const;
+
+  private:
+    struct segment
+    {
+      std::string name;
+      std::size_t index;  ///< the name as array index, or npos
+    };
+
+    struct part
+    {
+      enum kind_type { literal, json, env, end_argument };
+
+      kind_type kind;
+      std::size_t offset{0};  ///< literal, env: of the text in mText; json: of the path in mPaths
+      std::size_t size{0};
+    };
+
+    class parser;
+
+    static const nlohmann::json* lookup(const nlohmann::json& json, const std::vector<segment>& path) noexcept;
+
+    std::string mText;
+    std::vector<std::vector<segment>> mPaths;
+    std::vector<part> mParts;
+    std::shared_ptr<const process::command_line> mCommandLine;  ///< if there are no placeholders
+};
@@ -0,0 +1,231 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "completion_store.h"
+#include "hash.h"
+#include "io_context.h"
+#include "log.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <event2/event.h>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <stdexcept>
+#include <unordered_map>
+
+
+
+namespace {
+
+constexpr std::string_view magic{"GLHDONE1"};
+
+}  // namespace
+
+
+
+struct completion_store::impl
+{
+  static impl* singleton;
+
+  std::size_t capacity;
+  std::string fileName;
+  std::list<std::uint64_t> keys;  ///< the least recently used first
+  std::unordered_map<std::uint64_t,std::list<std::uint64_t>::iterator> index;
+  std::unique_ptr<event,free_event> saveEv;
+  bool modified{false};
+
+  impl(io_context& context, std::size_t capacity, const std::string& fileName);
+  ~impl();
+
+  void insert(std::uint64_t hash);
+  void load();
+  void save();
+  static void saveCb(int, short, void* cls) noexcept;
+};
+
+
+completion_store::impl* completion_store::impl::singleton = nullptr;
+
+
+
+completion_store::completion_store(io_context& context, std::size_t capacity, const std::string& fileName)
+  : m{new impl{context, capacity, fileName}}
+{}
+
+
+completion_store::~completion_store()
+= default;
+
+
+void completion_store::impl_delete::operator()(impl* p) noexcept
+{ delete p; }
+
+
+
+completion_store::impl::impl(io_context& context, std::size_t capacity, const std::string& fileName)
+  : capacity{capacity},
+    fileName{fileName},
+    saveEv{context.new_event<&saveCb>(-1, 0, this, "completion_store::saveCb")}
+{
+  if (!fileName.empty())
+    load();
+
+  assert(!singleton);
+  singleton = this;
+}
+
+
+
+completion_store::impl::~impl()
+{
+  if (modified)
+  {
+    try {
+      save();
+    }
+    catch (const std::exception& e)
+    {
+      log_error("%s", e.what());
+    }
+  }
+
+  singleton = nullptr;
+}
+
+
+
+void completion_store::impl::insert(std::uint64_t hash)
+{
+  auto iter = index.find(hash);
+  if (iter != index.end())
+    keys.erase(iter->second);
+  else if (keys.size() == capacity)
+  {
+    index.erase(keys.front());
+    keys.pop_front();
+  }
+
+  index[hash] = keys.insert(keys.end(), hash);
+}
+
+
+
+void completion_store::impl::load()
+{
+  std::ifstream in{fileName, std::ios::binary};
+  if (!in)
+  {
+    if (errno != ENOENT)
+      throw std::runtime_error{"failed to open completion file " + fileName + ": " + strerror(errno)};
+
+    return;
+  }
+
+  std::string data{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+  if (!std::string_view{data}.starts_with(magic) || (data.size() - magic.size()) % 8 != 0)
+    throw std::runtime_error{"invalid completion file " + fileName};
+
+  for (auto pos = magic.size(); pos != data.size(); pos += 8)
+  {
+    std::uint64_t hash = 0;
+    for (int i = 7; i >= 0; --i)
+      hash = hash << 8 | static_cast<unsigned char>(data[pos + static_cast<std::size_t>(i)]);
+
+    insert(hash);
+  }
+}
+
+
+
+void completion_store::impl::save()
+{
+  event_del(saveEv.get());
+  modified = false;
+
+  std::string data{magic};
+  data.reserve(magic.size() + keys.size() * 8);
+  for (auto hash: keys)
+    for (int i = 0; i != 8; ++i)
+      data.push_back(static_cast<char>(hash >> (i * 8)));
+
+  // Replace the file atomically, so that it is complete after a crash.
+  auto tmpName = fileName + ".tmp";
+  std::ofstream out{tmpName, std::ios::binary|std::ios::trunc};
+  out.write(data.data(), static_cast<std::streamsize>(data.size()));
+  out.close();
+
+  if (!out || std::rename(tmpName.c_str(), fileName.c_str()) == -1)
+    throw std::runtime_error{"failed to write completion file " + fileName + ": " + strerror(errno)};
+}
+
+
+
+void completion_store::impl::saveCb(int, short, void* cls) noexcept
+{
+  try {
+    static_cast<impl*>(cls)->save();
+  }
+  catch (const std::exception& e)
+  {
+    log_error("%s", e.what());
+  }
+}
+
+
+
+bool completion_store::contains(std::string_view key) noexcept
+{
+  auto self = impl::singleton;
+  if (!self)
+    return false;
+
+  auto iter = self->index.find(fnv1a(key));
+  if (iter == self->index.end())
+    return false;
+
+  self->keys.splice(self->keys.end(), self->keys, iter->second);
+  return true;
+}
+
+
+
+void completion_store::record(std::string_view key) noexcept
+{
+  auto self = impl::singleton;
+  if (!self)
+    return;
+
+  try {
+    self->insert(fnv1a(key));
+    if (!self->fileName.empty() && !self->modified)
+    {
+      // Collect the completions of a second, instead of rewriting the file for each.
+      self->modified = true;
+
+      timeval tm{};
+      tm.tv_sec = 1;
+      event_add(self->saveEv.get(), &tm);
+    }
+  }
+  catch (const std::exception& e)
+  {
+    log_error("%s", e.what());
+  }
+}
@@ -0,0 +1,63 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+class io_context;
+
+
+
+/// The keys of actions that completed successfully, for hooks that skip
+/// events they already handled, see the hook configuration entry
+/// "skip_if_done_for". A key is stored as its 64 bit hash; at most a given
+/// number of keys is kept, and the least recently used key is forgotten first.
+/// If there is a file, it is rewritten at most once per second after a change,
+/// and on destruction, so that the keys survive restarts. This object must be
+/// created as a singleton.
+///
+/// The file starts with the 8 bytes "GLHDONE1", followed by the hashes as
+/// little-endian u64, the least recently used first.
+class completion_store
+{
+  public:
+    /// Creates a store for up to \a capacity keys, and reads the keys from
+    /// the file with given \a fileName, unless it is empty. The file is
+    /// written via the I/O \a context.
+    completion_store(io_context& context, std::size_t capacity, const std::string& fileName);
+
+    ~completion_store();
+
+    /// Whether the \a key has been recorded. Marks the key as recently used.
+    /// Always false if there is no completion_store.
+    static bool contains(std::string_view key) noexcept;
+
+    /// Records the \a key, if there is a completion_store.
+    static void record(std::string_view key) noexcept;
+
+  private:
+    struct impl;
+    struct impl_delete
+    {
+      constexpr impl_delete() noexcept = default;
+      void operator()(impl* p) noexcept;
+    };
+
+    std::unique_ptr<impl,impl_delete> m;
+};
@@ -30,18 +30,18 @@ debug_hook::debug_hook(config::item configuration)
 
 
 
-auto debug_hook::process(http::request request, const nlohmann::json& json) const -> outcome
+auto debug_hook::process(const event& event) const -> outcome
 {
-  auto event = std::string{request.header("X-Gitlab-Event")};
-  auto sjson = json.dump(2, ' ', true, nlohmann::json::error_handler_t::replace);
+  auto type  = std::string{event.type};
+  auto sjson = event.json.dump(2, ' ', true, nlohmann::json::error_handler_t::replace);
 
-  return execute(request,
-    [event = std::move(event), json = std::move(sjson)]()
+  return execute(event,
+    [type = std::move(type), json = std::move(sjson)]()
     {
       printf("X-Gitlab-Event: %s\n"
              "%s\n"
              "--------------------------------------------------------------------------------\n",
-             event.c_str(), json.c_str());
+             type.c_str(), json.c_str());
 
       fflush(stdout);
     }
@@ -27,5 +27,5 @@ class debug_hook : public hook
     explicit debug_hook(config::item configuration);
 
   protected:
-    outcome process(http::request request, const nlohmann::json& json) const override;
+    outcome process(const event& event) const override;
 };
@@ -0,0 +1,254 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "event_cache.h"
+#include "hash.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+
+
+namespace {
+
+/// A slot of the table, empty if hash is 0.
+struct slot
+{
+  std::uint64_t hash;
+  std::int64_t expires;  ///< seconds since the Unix epoch
+};
+
+/// Layout of the file, followed by the slots.
+struct file_header
+{
+  static constexpr char magicValue[8] = {'G','L','H','E','V','T','I','D'};
+  static constexpr std::uint32_t currentVersion = 1;
+
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t reserved;
+  std::uint64_t capacity;
+};
+
+constexpr std::size_t probeLength = 8;
+
+}  // namespace
+
+
+
+struct event_cache::impl
+{
+  static impl* singleton;
+
+  std::vector<slot> memory;
+  slot* slots{nullptr};
+  std::size_t capacity;
+  std::chrono::seconds expiry;
+  void* mapping{nullptr};
+  std::size_t mappingSize{0};
+
+  impl(std::size_t capacity, std::chrono::seconds expiry, const std::string& fileName);
+  ~impl();
+
+  void map(const std::string& fileName);
+
+  static std::uint64_t hash(std::string_view id) noexcept;
+  static std::int64_t now() noexcept;
+};
+
+
+event_cache::impl* event_cache::impl::singleton = nullptr;
+
+
+
+event_cache::event_cache(std::size_t capacity, std::chrono::seconds expiry, const std::string& fileName)
+  : m{new impl{capacity, expiry, fileName}}
+{}
+
+
+event_cache::~event_cache()
+= default;
+
+
+void event_cache::impl_delete::operator()(impl* p) noexcept
+{ delete p; }
+
+
+
+event_cache::impl::impl(std::size_t capacity, std::chrono::seconds expiry, const std::string& fileName)
+  : capacity{std::bit_ceil(std::max(capacity, probeLength))},
+    expiry{expiry}
+{
+  if (fileName.empty())
+  {
+    memory.resize(this->capacity);
+    slots = memory.data();
+  }
+  else
+    map(fileName);
+
+  assert(!singleton);
+  singleton = this;
+}
+
+
+
+event_cache::impl::~impl()
+{
+  if (mapping)
+    munmap(mapping, mappingSize);
+
+  singleton = nullptr;
+}
+
+
+
+void event_cache::impl::map(const std::string& fileName)
+{
+  int fd = open(fileName.c_str(), O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+  if (fd == -1)
+    throw std::system_error{errno, std::system_category(), "failed to open event cache file " + fileName};
+
+  struct stat st;
+  mappingSize = sizeof(file_header) + capacity * sizeof(slot);
+  bool reuse  = fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) == mappingSize;
+
+  if (!reuse && (ftruncate(fd, 0) == -1 || ftruncate(fd, static_cast<off_t>(mappingSize)) == -1))
+  {
+    int error = errno;
+    close(fd);
+    throw std::system_error{error, std::system_category(), "failed to resize event cache file " + fileName};
+  }
+
+  mapping = mmap(nullptr, mappingSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  int error = errno;
+  close(fd);
+
+  if (mapping == MAP_FAILED)
+  {
+    mapping = nullptr;
+    throw std::system_error{error, std::system_category(), "failed to map event cache file " + fileName};
+  }
+
+  auto header = static_cast<file_header*>(mapping);
+  slots = reinterpret_cast<slot*>(header + 1);
+
+  if (memcmp(header->magic, file_header::magicValue, sizeof(header->magic)) != 0
+      || header->version != file_header::currentVersion || header->capacity != capacity)
+  {
+    memset(mapping, 0, mappingSize);
+    memcpy(header->magic, file_header::magicValue, sizeof(header->magic));
+    header->version  = file_header::currentVersion;
+    header->capacity = capacity;
+  }
+}
+
+
+
+inline std::uint64_t event_cache::impl::hash(std::string_view id) noexcept
+{
+  auto result = fnv1a(id);
+  return result ? result : 1;
+}
+
+
+
+inline std::int64_t event_cache::impl::now() noexcept
+{
+  using namespace std::chrono;
+  return duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+}
+
+
+
+bool event_cache::contains(std::string_view id) noexcept
+{
+  auto self = impl::singleton;
+  if (!self)
+    return false;
+
+  auto hash = impl::hash(id);
+  auto time = impl::now();
+  auto mask = self->capacity - 1;
+
+  for (std::size_t i = 0; i != probeLength; ++i)
+  {
+    auto& slot = self->slots[(hash + i) & mask];
+    if (slot.hash == hash && slot.expires > time)
+      return true;
+  }
+
+  return false;
+}
+
+
+
+void event_cache::remember(std::string_view id) noexcept
+{
+  auto self = impl::singleton;
+  if (!self)
+    return;
+
+  auto hash   = impl::hash(id);
+  auto time   = impl::now();
+  auto mask   = self->capacity - 1;
+  auto target = &self->slots[hash & mask];
+
+  for (std::size_t i = 0; i != probeLength; ++i)
+  {
+    auto& slot = self->slots[(hash + i) & mask];
+    if (slot.hash == hash || slot.hash == 0 || slot.expires <= time)
+    {
+      target = &slot;
+      break;
+    }
+
+    if (slot.expires < target->expires)
+      target = &slot;
+  }
+
+  target->hash    = hash;
+  target->expires = time + self->expiry.count();
+}
+
+
+
+void event_cache::forget(std::string_view id) noexcept
+{
+  auto self = impl::singleton;
+  if (!self)
+    return;
+
+  auto hash = impl::hash(id);
+  auto mask = self->capacity - 1;
+
+  for (std::size_t i = 0; i != probeLength; ++i)
+  {
+    auto& slot = self->slots[(hash + i) & mask];
+    if (slot.hash == hash)
+      slot = {};
+  }
+}
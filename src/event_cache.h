@@ -0,0 +1,65 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+
+
+/// The ids of recently received webhook events, from the X-Gitlab-Event-UUID
+/// header, to recognize events that Gitlab delivers again, e.g. after a
+/// timeout. The ids are kept in a fixed-capacity hash table with open
+/// addressing: an id is stored as 64 bit hash in one of the 8 slots following
+/// its home slot, replacing an expired or else the oldest entry there. The
+/// table can be kept in a memory-mapped file, so that it survives restarts.
+/// This object must be created as a singleton.
+class event_cache
+{
+  public:
+    /// Creates a table for \a capacity ids, rounded up to a power of two,
+    /// which expire after \a expiry. If \a fileName is not empty, the table
+    /// is mapped from that file, which is created or reused if its capacity
+    /// matches.
+    event_cache(std::size_t capacity, std::chrono::seconds expiry, const std::string& fileName);
+
+    ~event_cache();
+
+    /// Whether the event with given \a id has been remembered and not yet
+    /// expired. Always false if there is no event_cache.
+    static bool contains(std::string_view id) noexcept;
+
+    /// Remembers the event with given \a id, if there is an event_cache.
+    static void remember(std::string_view id) noexcept;
+
+    /// Forgets the event with given \a id, so that it is processed when it is
+    /// delivered again, for example because its request failed.
+    static void forget(std::string_view id) noexcept;
+
+  private:
+    struct impl;
+    struct impl_delete
+    {
+      constexpr impl_delete() noexcept = default;
+      void operator()(impl* p) noexcept;
+    };
+
+    std::unique_ptr<impl,impl_delete> m;
+};
@@ -0,0 +1,459 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "filter.h"
+#include "pattern.h"
+#include <algorithm>
+#include <cctype>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+
+
+using json = nlohmann::json;
+
+
+
+struct filter::impl
+{
+  /// A segment of a JSON pointer, resolved at compile time.
+  struct segment
+  {
+    std::string key;
+    std::size_t index;  ///< the key as array index, or npos
+    bool wildcard;
+  };
+
+  struct node
+  {
+    enum kind_type { or_, and_, not_, exists, eq, ne, lt, le, gt, ge, match, not_match, in };
+
+    kind_type kind;
+    std::size_t left{0};     ///< or, and, not: operand node; else: pointer
+    std::size_t right{0};    ///< or, and: operand node; match: pattern; else: value
+  };
+
+  std::vector<node> nodes;  ///< operands before the nodes using them, the last one is the root
+  std::vector<std::vector<segment>> pointers;
+  std::vector<json> values;
+  std::vector<pattern_set> patterns;
+
+  class parser;
+
+  bool evaluate(std::size_t index, const json& content) const noexcept;
+  bool compare(const node& n, const json& value) const noexcept;
+
+  template<typename Predicate>
+  bool any_of(const std::vector<segment>& pointer, std::size_t index, const json& value, const Predicate& pred) const noexcept;
+};
+
+
+
+/// Compiles a filter expression into a filter::impl.
+class filter::impl::parser
+{
+  public:
+    parser(impl& result, std::string_view expression) noexcept
+      : mResult{result},
+        mExpression{expression},
+        mText{expression}
+    {}
+
+    void parse()
+    {
+      disjunction();
+      if (!next().empty())
+        fail("unexpected '" + std::string{next()} + "'");
+    }
+
+  private:
+    [[noreturn]] void fail(const std::string& reason) const
+    {
+      throw std::runtime_error{"invalid filter '" + std::string{mExpression} + "' at position "
+                               + std::to_string(mExpression.size() - mText.size()) + ": " + reason};
+    }
+
+    /// The next token, without consuming it.
+    std::string_view next()
+    {
+      while (!mText.empty() && std::isspace(static_cast<unsigned char>(mText.front())))
+        mText.remove_prefix(1);
+
+      if (mText.empty())
+        return {};
+
+      char c = mText.front();
+      if (c == '(' || c == ')' || c == '[' || c == ']' || c == ',')
+        return mText.substr(0, 1);
+
+      if (c == '"')
+      {
+        std::size_t end = 1;
+        while (end < mText.size() && mText[end] != '"')
+          end += mText[end] == '\\' ? 2 : 1;
+
+        if (end >= mText.size())
+          fail("unterminated string");
+
+        return mText.substr(0, end + 1);
+      }
+
+      // Operators end pointers and values, so they need no space around them.
+      if (c == '=' || c == '!' || c == '<' || c == '>')
+        return mText.substr(0, mText.size() > 1 && (mText[1] == '=' || mText[1] == '~') ? 2 : 1);
+
+      auto end = mText.find_first_of(" \t\r\n()[],\"=!<>");
+      return mText.substr(0, end);
+    }
+
+    std::string_view take()
+    {
+      auto token = next();
+      mText.remove_prefix(token.size());
+      return token;
+    }
+
+    std::size_t add(node n)
+    {
+      mResult.nodes.push_back(n);
+      return mResult.nodes.size() - 1;
+    }
+
+    std::size_t disjunction()
+    {
+      auto result = conjunction();
+      while (next() == "or")
+      {
+        take();
+        auto right = conjunction();
+        result = add({node::or_, result, right});
+      }
+
+      return result;
+    }
+
+    std::size_t conjunction()
+    {
+      auto result = negation();
+      while (next() == "and")
+      {
+        take();
+        auto right = negation();
+        result = add({node::and_, result, right});
+      }
+
+      return result;
+    }
+
+    std::size_t negation()
+    {
+      if (next() == "not")
+      {
+        take();
+        auto operand = negation();
+        return add({node::not_, operand});
+      }
+
+      if (next() == "(")
+      {
+        take();
+        auto result = disjunction();
+        if (take() != ")")
+          fail("missing ')'");
+
+        return result;
+      }
+
+      return comparison();
+    }
+
+    std::size_t comparison()
+    {
+      auto token = take();
+      if (!token.starts_with('/'))
+        fail(token.empty() ? "unexpected end" : "expected a JSON pointer instead of '" + std::string{token} + "'");
+
+      auto pointer = mResult.pointers.size();
+      mResult.pointers.push_back(segments(token));
+
+      static constexpr std::pair<std::string_view,node::kind_type> operators[] = {
+        {"==", node::eq}, {"!=", node::ne}, {"<", node::lt}, {"<=", node::le}, {">", node::gt},
+        {">=", node::ge}, {"=~", node::match}, {"!~", node::not_match}, {"in", node::in}
+      };
+
+      auto op = std::find_if(std::begin(operators), std::end(operators), [token = next()](auto& entry)
+      { return entry.first == token; });
+
+      if (op == std::end(operators))
+        return add({node::exists, pointer});
+
+      take();
+      auto value = this->value();
+      switch (op->second)
+      {
+        case node::match:
+        case node::not_match:
+        {
+          if (!value.is_string())
+            fail("expected a regular expression string");
+
+          pattern_set pattern;
+          try {
+            pattern.add_regex(value.get_ref<const std::string&>());
+            pattern.compile();
+          }
+          catch (const std::runtime_error& e)
+          {
+            fail(e.what());
+          }
+
+          mResult.patterns.push_back(std::move(pattern));
+          return add({op->second, pointer, mResult.patterns.size() - 1});
+        }
+
+        case node::in:
+          if (!value.is_array())
+            fail("expected a list");
+          break;
+
+        case node::lt:
+        case node::le:
+        case node::gt:
+        case node::ge:
+          if (!value.is_number() && !value.is_string())
+            fail("expected a number or string");
+          break;
+
+        default:
+          if (value.is_array())
+            fail("unexpected list");
+          break;
+      }
+
+      mResult.values.push_back(std::move(value));
+      return add({op->second, pointer, mResult.values.size() - 1});
+    }
+
+    json value()
+    {
+      auto token = take();
+      if (token == "[")
+      {
+        auto result = json::array();
+        if (next() == "]")
+          return take(), result;
+
+        for (;;)
+        {
+          auto element = value();
+          if (element.is_array())
+            fail("unexpected list");
+
+          result.push_back(std::move(element));
+          auto separator = take();
+          if (separator == "]")
+            return result;
+
+          if (separator != ",")
+            fail("expected ',' or ']'");
+        }
+      }
+
+      if (token.empty() || token == "]" || token == ")" || token == "(" || token == ",")
+        fail("expected a value");
+
+      auto result = json::parse(token, nullptr, false);
+      if (result.is_discarded() || result.is_object() || result.is_array())
+        fail("invalid value '" + std::string{token} + "'");
+
+      return result;
+    }
+
+    std::vector<segment> segments(std::string_view pointer)
+    {
+      std::vector<segment> result;
+      while (!pointer.empty())
+      {
+        pointer.remove_prefix(1);
+        auto end  = pointer.find('/');
+        auto text = pointer.substr(0, end);
+        pointer   = end == pointer.npos ? std::string_view{} : pointer.substr(end);
+
+        segment segment{{}, std::string::npos, text == "*"};
+        for (std::size_t i = 0; i != text.size(); ++i)
+          if (text[i] != '~')
+            segment.key += text[i];
+          else if (i + 1 != text.size() && (text[i + 1] == '0' || text[i + 1] == '1'))
+            segment.key += text[++i] == '0' ? '~' : '/';
+          else
+            fail("invalid escape in JSON pointer");
+
+        bool isIndex = !text.empty() && text.size() < 10 && (text == "0" || text.front() != '0')
+                       && text.find_first_not_of("0123456789") == text.npos;
+        if (isIndex)
+          segment.index = std::stoul(segment.key);
+
+        result.push_back(std::move(segment));
+      }
+
+      return result;
+    }
+
+    impl& mResult;
+    std::string_view mExpression;
+    std::string_view mText;
+};
+
+
+
+template<typename Predicate>
+bool filter::impl::any_of(const std::vector<segment>& pointer, std::size_t index, const json& value, const Predicate& pred) const noexcept
+{
+  if (index == pointer.size())
+    return pred(value);
+
+  auto& segment = pointer[index];
+  if (segment.wildcard && (value.is_array() || value.is_object()))
+  {
+    for (auto& element: value)
+      if (any_of(pointer, index + 1, element, pred))
+        return true;
+
+    return false;
+  }
+
+  if (value.is_object())
+  {
+    auto iter = value.find(segment.key);
+    return iter != value.end() && any_of(pointer, index + 1, *iter, pred);
+  }
+
+  if (value.is_array() && segment.index < value.size())
+    return any_of(pointer, index + 1, value[segment.index], pred);
+
+  return false;
+}
+
+
+
+bool filter::impl::compare(const node& n, const json& value) const noexcept
+{
+  switch (n.kind)
+  {
+    case node::exists:
+      return !value.is_null() && value != false;
+
+    case node::eq:
+    case node::ne:
+      return value == values[n.right];
+
+    case node::lt:
+    case node::le:
+    case node::gt:
+    case node::ge:
+    {
+      auto& other = values[n.right];
+      int order;
+      if (value.is_number() && other.is_number())
+      {
+        auto lhs = value.get<double>(), rhs = other.get<double>();
+        order = lhs < rhs ? -1 : lhs > rhs ? 1 : 0;
+      }
+      else if (value.is_string() && other.is_string())
+        order = value.get_ref<const std::string&>().compare(other.get_ref<const std::string&>());
+      else
+        return false;
+
+      switch (n.kind)
+      {
+        case node::lt: return order < 0;
+        case node::le: return order <= 0;
+        case node::gt: return order > 0;
+        default:       return order >= 0;
+      }
+    }
+
+    case node::match:
+    case node::not_match:
+      return value.is_string() && patterns[n.right].matches(value.get_ref<const std::string&>());
+
+    case node::in:
+      for (auto& element: values[n.right])
+        if (value == element)
+          return true;
+
+      return false;
+
+    default:
+      return false;
+  }
+}
+
+
+
+bool filter::impl::evaluate(std::size_t index, const json& content) const noexcept
+{
+  auto& n = nodes[index];
+  switch (n.kind)
+  {
+    case node::or_:  return evaluate(n.left, content) || evaluate(n.right, content);
+    case node::and_: return evaluate(n.left, content) && evaluate(n.right, content);
+    case node::not_: return !evaluate(n.left, content);
+    default:         break;
+  }
+
+  bool result = any_of(pointers[n.left], 0, content, [this, &n](const json& value)
+  { return compare(n, value); });
+
+  return n.kind == node::ne || n.kind == node::not_match ? !result : result;
+}
+
+
+
+void filter::impl_delete::operator()(impl* p) noexcept
+{ delete p; }
+
+
+
+filter::filter() noexcept
+= default;
+
+
+
+filter::filter(std::string_view expression)
+  : m{new impl}
+{ impl::parser{*m, expression}.parse(); }
+
+
+
+filter::filter(filter&&) noexcept
+= default;
+
+
+
+filter& filter::operator=(filter&&) noexcept
+= default;
+
+
+
+filter::~filter()
+= default;
+
+
+
+bool filter::matches(const nlohmann::json& json) const noexcept
+{ return !m || m->evaluate(m->nodes.size() - 1, json); }
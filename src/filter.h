@@ -0,0 +1,68 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <memory>
+#include <nlohmann/json_fwd.hpp>
+#include <string_view>
+
+
+
+/// A condition on the json content of a webhook event, compiled once from an
+/// expression and then evaluated without allocating memory. An expression
+/// combines comparisons with `and`, `or`, `not` and parentheses:
+///
+///     /object_attributes/ref =~ "^release/" and /object_attributes/duration > 60
+///
+/// The left side of a comparison is a JSON pointer, the right side a string,
+/// number, `true`, `false`, `null`, or a list `[...]` of these. The operators
+/// are `==`, `!=`, `<`, `<=`, `>`, `>=`, `=~` and `!~` for regular
+/// expressions, see pattern_set, and `in` for lists. A pointer on its own
+/// tests whether the value exists and is neither `null` nor `false`. Since a
+/// pointer ends at the first operator character, `=!<>`, keys containing
+/// these characters cannot be used.
+///
+/// A pointer segment `*` stands for every element of an array or object; the
+/// comparison holds if it holds for any of them. A comparison with a pointer
+/// that does not resolve is false, except for `!=` and `!~`, which are the
+/// negations of `==` and `=~`.
+class filter
+{
+  public:
+    /// Constructs an empty filter, which matches everything.
+    filter() noexcept;
+
+    /// Compiles the \a expression. Throws if it is invalid.
+    explicit filter(std::string_view expression);
+
+    filter(filter&&) noexcept;
+    filter& operator=(filter&&) noexcept;
+    ~filter();
+
+    /// Whether the \a json content matches the filter.
+    bool matches(const nlohmann::json& json) const noexcept;
+
+  private:
+    struct impl;
+    struct impl_delete
+    {
+      constexpr impl_delete() noexcept = default;
+      void operator()(impl* p) noexcept;
+    };
+
+    std::unique_ptr<impl,impl_delete> m;
+};
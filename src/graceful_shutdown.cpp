@@ -0,0 +1,117 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "action_list.h"
+#include "graceful_shutdown.h"
+#include "io_context.h"
+#include "log.h"
+#include <event2/event.h>
+#include <systemd/sd-daemon.h>
+
+
+
+struct graceful_shutdown::impl
+{
+  io_context& io;
+  std::unique_ptr<event,free_event> progressEv;
+  std::chrono::steady_clock::time_point deadline;
+  bool running{false};
+
+  explicit impl(io_context& context) noexcept;
+  void notifyProgress() noexcept;
+
+  static void progressCb(int, short, void* cls) noexcept;
+};
+
+
+
+graceful_shutdown::graceful_shutdown(io_context& context)
+  : m{new impl{context}}
+{}
+
+
+
+inline graceful_shutdown::impl::impl(io_context& context) noexcept
+  : io{context},
+    progressEv{io.new_event<&progressCb>(-1, EV_PERSIST, this, "graceful_shutdown::progressCb")}
+{}
+
+
+
+void graceful_shutdown::impl_delete::operator()(impl* p) noexcept
+{ delete p; }
+
+
+
+bool graceful_shutdown::is_running() const noexcept
+{ return m->running; }
+
+
+
+void graceful_shutdown::start(std::chrono::seconds timeout, bool waitPending)
+{
+  if (m->running)
+    return;
+
+  m->running  = true;
+  m->deadline = std::chrono::steady_clock::now() + timeout;
+
+  if (!waitPending)
+  {
+    auto count = action_list::size();
+    action_list::remove_pending();
+
+    if (count != action_list::size())
+      log_warning("dropped %zu pending hook(s)", count - action_list::size());
+  }
+
+  timeval tm{};
+  tm.tv_sec = 1;
+  event_add(m->progressEv.get(), &tm);
+
+  sd_notify(0, "STOPPING=1\n");
+  m->notifyProgress();
+
+  action_list::when_idle([this]()
+  {
+    log_info("all hooks completed");
+    m->io.stop();
+  });
+}
+
+
+
+void graceful_shutdown::impl::progressCb(int, short, void* cls) noexcept
+{
+  auto self = static_cast<impl*>(cls);
+  if (std::chrono::steady_clock::now() < self->deadline)
+    return self->notifyProgress();
+
+  log_warning("shutdown timeout elapsed with %zu hook(s) remaining", action_list::size());
+  self->io.stop();
+}
+
+
+
+void graceful_shutdown::impl::notifyProgress() noexcept
+{
+  using namespace std::chrono;
+  auto remaining = duration_cast<seconds>(deadline - steady_clock::now());
+
+  sd_notifyf(0, "STATUS=Shutting down, waiting for %zu hook(s), %lis left\n",
+             action_list::size(), static_cast<long>(remaining.count()));
+}
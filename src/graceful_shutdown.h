@@ -0,0 +1,52 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <chrono>
+#include <memory>
+class io_context;
+
+
+
+/// Graceful shutdown of the application: lets the actions complete, up to a
+/// deadline, and reports the progress to systemd.
+class graceful_shutdown
+{
+  public:
+    /// Constructs the object, with asynchronous I/O being done via the given
+    /// I/O \a context.
+    explicit graceful_shutdown(io_context& context);
+
+    /// Whether the shutdown has been started.
+    bool is_running() const noexcept;
+
+    /// Starts the shutdown. Stops the \a context's event loop as soon as the
+    /// action list is empty, or when the \a timeout has elapsed. Drops the
+    /// pending actions first, unless \a waitPending is set; the action that
+    /// is currently executing may always complete.
+    void start(std::chrono::seconds timeout, bool waitPending);
+
+  private:
+    struct impl;
+    struct impl_delete
+    {
+      constexpr impl_delete() noexcept = default;
+      void operator()(impl* p) noexcept;
+    };
+
+    std::unique_ptr<impl,impl_delete> m;
+};
@@ -0,0 +1,301 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "handover.h"
+#include "log.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <event2/event.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+
+
+// Version of the handover protocol. Increment on incompatible changes to the
+// protocol or the action snapshot format.
+constexpr std::uint64_t handoverVersion = 2;
+
+// Time to wait for the new instance to take over, in seconds.
+constexpr int handoverTimeout = 30;
+
+
+
+struct handover_header
+{
+  std::uint64_t version;
+  std::uint64_t size;
+};
+
+
+
+static void send_all(int fd, const char* data, size_t size)
+{
+  while (size)
+  {
+    auto count = send(fd, data, size, MSG_NOSIGNAL);
+    if (count == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      throw std::system_error{errno, std::system_category(), "failed to send handover state"};
+    }
+
+    data += count;
+    size -= static_cast<size_t>(count);
+  }
+}
+
+
+
+static void receive_all(int fd, char* data, size_t size)
+{
+  while (size)
+  {
+    auto count = recv(fd, data, size, 0);
+    if (count == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      throw std::system_error{errno, std::system_category(), "failed to receive handover state"};
+    }
+
+    if (count == 0)
+      throw std::runtime_error{"handover connection closed prematurely"};
+
+    data += count;
+    size -= static_cast<size_t>(count);
+  }
+}
+
+
+
+static void send_header(int fd, int listenFd, std::size_t size)
+{
+  handover_header header{handoverVersion, size};
+  iovec iov{&header, sizeof(header)};
+
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+
+  msghdr msg{};
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+
+  auto cmsg        = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &listenFd, sizeof(int));
+
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(header))
+    throw std::system_error{errno, std::system_category(), "failed to send handover state"};
+}
+
+
+
+handover::successor::successor(io_context& context, const std::vector<std::string>& args, int listenFd, std::string_view actions,
+                               std::function<void(bool)> finished)
+  : mFinished{std::move(finished)}
+{
+  if (listenFd == -1)
+    throw std::runtime_error{"no listening socket to hand over"};
+
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, sockets) == -1)
+    throw std::system_error{errno, std::system_category(), "failed to create handover socket"};
+
+  auto childArgs = args;
+  childArgs.push_back("--handover-fd=" + std::to_string(sockets[1]));
+
+  std::vector<char*> argv;
+  argv.reserve(childArgs.size() + 1);
+  for (auto& arg: childArgs)
+    argv.push_back(arg.data());
+  argv.push_back(nullptr);
+
+  // WATCHDOG_PID names this process, so the new instance would not trigger the
+  // systemd watchdog. Without it, WATCHDOG_USEC applies to any process.
+  std::vector<char*> envp;
+  for (auto env = environ; *env; ++env)
+    if (!std::string_view{*env}.starts_with("WATCHDOG_PID="))
+      envp.push_back(*env);
+  envp.push_back(nullptr);
+
+  pid_t pid = fork();
+  if (pid == -1)
+  {
+    close(sockets[0]);
+    close(sockets[1]);
+    throw std::system_error{errno, std::system_category(), "failed to fork new instance"};
+  }
+
+  if (pid == 0)
+  {
+    // In child process...
+    sigset_t sigMask;
+    sigfillset(&sigMask);
+    sigprocmask(SIG_UNBLOCK, &sigMask, nullptr);
+
+    fcntl(sockets[1], F_SETFD, 0);
+    execvpe(argv[0], argv.data(), envp.data());
+
+    fprintf(stderr, "execute %s failed: %s\n", argv[0], strerror(errno));
+    _exit(-1);
+  }
+
+  close(sockets[1]);
+  try {
+    send_header(sockets[0], listenFd, actions.size());
+    send_all(sockets[0], actions.data(), actions.size());
+
+    // The event loop keeps running while the new instance starts up.
+    mAcknowledgeEv.reset(context.new_event<&onAcknowledge>(sockets[0], EV_READ, this, "handover::successor::onAcknowledge"));
+    timeval tm{};
+    tm.tv_sec = handoverTimeout;
+    event_add(mAcknowledgeEv.get(), &tm);
+  }
+  catch (...)
+  {
+    close(sockets[0]);
+    ::kill(pid, SIGKILL);
+    throw;
+  }
+
+  mPid    = pid;
+  mSocket = sockets[0];
+}
+
+
+
+handover::successor::~successor()
+{
+  if (mSocket == -1)
+    return;
+
+  close(mSocket);
+  ::kill(mPid, SIGKILL);
+}
+
+
+
+void handover::successor::onAcknowledge(int fd, short what, void* cls) noexcept
+{
+  auto self = static_cast<successor*>(cls);
+
+  char ack;
+  bool tookOver = false;
+  if (what & EV_TIMEOUT)
+    log_error("new instance %i did not take over in time", static_cast<int>(self->mPid));
+  else if (recv(fd, &ack, 1, 0) == 1)
+    tookOver = true;
+  else
+    log_error("new instance %i exited before taking over", static_cast<int>(self->mPid));
+
+  close(self->mSocket);
+  self->mSocket = -1;
+  if (!tookOver)
+    ::kill(self->mPid, SIGKILL);
+
+  // The handler may destroy this object.
+  auto finished = std::move(self->mFinished);
+  finished(tookOver);
+}
+
+
+
+handover handover::receive(int fd)
+{
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  handover_header header;
+  iovec iov{&header, sizeof(header)};
+
+  char control[CMSG_SPACE(sizeof(int))];
+  msghdr msg{};
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC|MSG_WAITALL) != sizeof(header))
+    throw std::runtime_error{"failed to receive handover state"};
+
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    throw std::runtime_error{"no listening socket in handover state"};
+
+  int listenFd;
+  memcpy(&listenFd, CMSG_DATA(cmsg), sizeof(int));
+
+  if (header.version != handoverVersion)
+  {
+    close(listenFd);
+    throw std::runtime_error{"incompatible handover state version " + std::to_string(header.version)};
+  }
+
+  std::string actions(header.size, '\0');
+  receive_all(fd, actions.data(), actions.size());
+
+  log_info("received handover state with %zu bytes of pending hooks", actions.size());
+  return handover{fd, listenFd, std::move(actions)};
+}
+
+
+
+inline handover::handover(int socket, int listenFd, std::string actions) noexcept
+  : mSocket{socket},
+    mListenFd{listenFd},
+    mActions{std::move(actions)}
+{}
+
+
+
+handover::handover(handover&& other) noexcept
+  : mSocket{std::exchange(other.mSocket, -1)},
+    mListenFd{std::exchange(other.mListenFd, -1)},
+    mActions{std::move(other.mActions)}
+{}
+
+
+
+handover::~handover()
+{
+  if (mSocket != -1)
+    close(mSocket);
+}
+
+
+
+void handover::acknowledge() noexcept
+{
+  char ack = 1;
+  if (send(mSocket, &ack, 1, MSG_NOSIGNAL) != 1)
+    log_error("failed to acknowledge handover: %s", strerror(errno));
+
+  close(mSocket);
+  mSocket = -1;
+}
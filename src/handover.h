@@ -0,0 +1,102 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "io_context.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+
+
+/// The state that a running instance of this program hands over to a new
+/// instance on a live upgrade: the listening socket of the HTTP server and the
+/// pending actions. The new instance is started from the program binary on
+/// disk, which may have been replaced by a package upgrade.
+class handover
+{
+  public:
+    class successor;
+
+    /// Receives the state from the previous instance via socket \a fd, which
+    /// was given by the `--handover-fd` option.
+    static handover receive(int fd);
+
+    handover(handover&& other) noexcept;
+    ~handover();
+
+    /// The listening socket of the HTTP server.
+    int listen_socket() const noexcept
+    { return mListenFd; }
+
+    /// The pending actions, to be passed to action_list::restore().
+    std::string_view actions() const noexcept
+    { return mActions; }
+
+    /// Confirms to the previous instance that this instance took over. After
+    /// that, the previous instance stops accepting requests.
+    void acknowledge() noexcept;
+
+  private:
+    handover(int socket, int listenFd, std::string actions) noexcept;
+    handover(const handover&) = delete;
+    handover& operator=(const handover&) = delete;
+
+    int mSocket;
+    int mListenFd;
+    std::string mActions;
+};
+
+
+
+/// A new instance of the program, to which this instance hands over.
+class handover::successor
+{
+  public:
+    /// Starts a new instance of the program with command-line \a args, the
+    /// first being the program path, and the additional `--handover-fd`
+    /// option. Then passes the listening socket \a listenFd and the pending
+    /// \a actions, as written by action_list::save_pending(), to it. Once
+    /// the new instance acknowledges that it took over, calls \a finished
+    /// with true via the I/O \a context. If it exits or does not take over in
+    /// time, kills it and calls \a finished with false.
+    ///
+    /// \throws std::exception if the new instance could not be started.
+    successor(io_context& context, const std::vector<std::string>& args, int listenFd, std::string_view actions,
+              std::function<void(bool)> finished);
+
+    /// Kills the new instance, unless it took over already.
+    ~successor();
+
+    /// The process ID of the new instance.
+    pid_t pid() const noexcept
+    { return mPid; }
+
+  private:
+    successor(const successor&) = delete;
+    successor& operator=(const successor&) = delete;
+
+    static void onAcknowledge(int fd, short what, void* cls) noexcept;
+
+    pid_t mPid{-1};
+    int mSocket{-1};  ///< until the new instance took over or failed
+    std::unique_ptr<event,free_event> mAcknowledgeEv;
+    std::function<void(bool)> mFinished;
+};
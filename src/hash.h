@@ -0,0 +1,33 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+
+
+/// The 64 bit FNV-1a hash of \a data. It is stable across program versions,
+/// so it can be stored in files.
+inline std::uint64_t fnv1a(std::string_view data) noexcept
+{
+  std::uint64_t result = 0xcbf29ce484222325;
+  for (unsigned char c: data)
+    result = (result ^ c) * 0x100000001b3;
+
+  return result;
+}
@@ -16,17 +16,154 @@
     with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
 */
 #include "action_list.h"
+#include "capture.h"
+#include "completion_store.h"
 #include "debug_hook.h"
+#include "event_cache.h"
+#include "io_context.h"
+#include "job_hook.h"
 #include "log.h"
 #include "pipeline_hook.h"
+#include "push_hook.h"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <event2/event.h>
 #include <nlohmann/json.hpp>
 
 
 
-size_t hook::hooksRequests{0};
-size_t hook::hooksGoodRequests{0};
-size_t hook::hooksScheduled{0};
+struct hook::batch
+{
+  const hook& owner;
+  ::event* timer;
+  std::chrono::seconds window;
+  std::size_t maxSize;
+
+  std::size_t size{0};
+  command_template command;          ///< of the latest event, expanded on flush
+  process::environment environment;  ///< of the latest event
+  std::shared_ptr<const std::string> payload;  ///< of the latest event
+  trace span;                        ///< of the latest event
+  std::vector<std::string> pipelineIds;
+  std::vector<std::string> commitShas;
+  std::vector<std::string> projectPaths;
+  std::vector<std::string> doneKeys;
+
+  static std::vector<batch*> pending;
+
+  batch(const hook& owner, std::chrono::seconds window, std::size_t maxSize);
+  ~batch();
+
+  void add(command_template latestCommand, process::environment latest,
+           std::shared_ptr<const std::string> latestPayload, trace latestSpan, std::string doneKey);
+  void flush();
+
+  static void timerCb(int, short, void* cls) noexcept;
+};
+
+
+std::vector<hook::batch*> hook::batch::pending;
+
+
+
+hook::batch::batch(const hook& owner, std::chrono::seconds window, std::size_t maxSize)
+  : owner{owner},
+    timer{action_list::get_io_context().new_event<&timerCb>(-1, 0, this, "hook::batch::timerCb")},
+    window{window},
+    maxSize{maxSize}
+{}
+
+
+hook::batch::~batch()
+{
+  if (size)
+    log_warning("hook '%s' dropped batch of %zu event(s)", owner.name.c_str(), size);
+
+  std::erase(pending, this);
+  event_free(timer);
+}
+
+
+
+void hook::batch::add(command_template latestCommand, process::environment latest,
+                      std::shared_ptr<const std::string> latestPayload, trace latestSpan, std::string doneKey)
+{
+  auto collect = [&latest](std::vector<std::string>& list, std::string_view name)
+  {
+    auto value = latest.value(name);
+    if (!value.empty())
+      list.emplace_back(value);
+  };
+
+  collect(pipelineIds, "CI_PIPELINE_ID");
+  collect(commitShas, "CI_COMMIT_SHA");
+  collect(projectPaths, "CI_PROJECT_PATH");
+  if (!doneKey.empty())
+    doneKeys.push_back(std::move(doneKey));
+
+  // The command is traced for the latest event only.
+  if (span)
+    span.finish("batched");
+
+  command     = std::move(latestCommand);
+  environment = std::move(latest);
+  payload     = std::move(latestPayload);
+  span        = std::move(latestSpan);
+
+  if (++size == maxSize)
+    return flush();
+
+  if (size == 1)
+  {
+    timeval tm{};
+    tm.tv_sec = window.count();
+    event_add(timer, &tm);
+    pending.push_back(this);
+  }
+
+  log_debug("hook '%s' collected event for batch of %zu", owner.name.c_str(), size);
+}
+
+
+
+void hook::batch::flush()
+{
+  event_del(timer);
+  std::erase(pending, this);
+  if (!size)
+    return;
+
+  environment.set_list("CI_PIPELINE_IDS", pipelineIds);
+  environment.set_list("CI_COMMIT_SHAS", commitShas);
+  environment.set_list("CI_PROJECT_PATHS", projectPaths);
+  log_info("hook '%s' executes batch of %zu event(s)", owner.name.c_str(), size);
+
+  // The lists are set only now, so the placeholders are expanded now, too.
+  auto commandLine = std::exchange(command, {}).expand(environment);
+
+  size = 0;
+  pipelineIds.clear();
+  commitShas.clear();
+  projectPaths.clear();
+  owner.schedule(std::move(commandLine), std::exchange(environment, {}), std::exchange(payload, {}),
+                 std::exchange(span, {}), std::exchange(doneKeys, {}));
+}
+
+
+
+void hook::batch::timerCb(int, short, void* cls) noexcept
+{
+  auto self = static_cast<batch*>(cls);
+  io_context::set_subject(self->owner.name);
+
+  try {
+    self->flush();
+  }
+  catch (const std::exception& e)
+  {
+    log_error("failed scheduling batch of hook '%s': %s", self->owner.name.c_str(), e.what());
+  }
+}
 
 
 
@@ -35,6 +172,14 @@ void hook::init_global(config::item configuration)
 
 
 
+void hook::flush_batches()
+{
+  while (!batch::pending.empty())
+    batch::pending.back()->flush();
+}
+
+
+
 std::unique_ptr<hook> hook::create(config::item configuration)
 {
   auto type = configuration["type"].to_string_view();
@@ -42,6 +187,12 @@ std::unique_ptr<hook> hook::create(config::item configuration)
     return std::make_unique<debug_hook>(configuration);
   else if (type == "pipeline")
     return std::make_unique<pipeline_hook>(configuration);
+  else if (type == "job")
+    return std::make_unique<job_hook>(configuration);
+  else if (type == "push")
+    return std::make_unique<push_hook>(configuration, false);
+  else if (type == "tag_push")
+    return std::make_unique<push_hook>(configuration, true);
   else
     throw std::runtime_error{"invalid hook type"};
 }
@@ -71,6 +222,16 @@ inline std::string_view trimmed(std::string_view string) noexcept
 
 
 
+// The variables that hooks set for an event before it is looked up in the
+// completion_store, see doneKeyFor().
+static constexpr std::string_view eventVariables[] = {
+  "CI_COMMIT_BEFORE_SHA", "CI_COMMIT_BRANCH", "CI_COMMIT_REF_NAME", "CI_COMMIT_SHA", "CI_COMMIT_TAG",
+  "CI_JOB_ID", "CI_JOB_IDS", "CI_JOB_NAME", "CI_JOB_NAMES", "CI_JOB_STAGE", "CI_JOB_STATUS", "CI_PIPELINE_ID",
+  "CI_PROJECT_ID", "CI_PROJECT_PATH", "CI_PROJECT_TITLE", "CI_PROJECT_URL", "CI_SERVER_URL"
+};
+
+
+
 static std::vector<std::string_view> string_list_from(config::item configuration)
 {
   std::vector<std::string_view> result;
@@ -87,20 +248,64 @@ static std::vector<std::string_view> string_list_from(config::item configuration
 hook::hook(config::item configuration)
   : uri_path{configuration["uri_path"].to_string()},
     name{configuration["name"].to_string()},
-    mToken{configuration["token"].to_string_view()}
+    mToken{configuration["token"].to_string_view()},
+    mStatsId{metrics::hook_id(name)}
 {
   if (configuration.contains("peer_address"))
     mAllowedAddress = configuration["peer_address"].to_string_view();
 
+  // Command and environment are prepared once, and shared by all processes where possible.
   if (configuration.contains("command"))
-    mCommand = trimmed(configuration["command"].to_string_view());
+  {
+    mCommand         = trimmed(configuration["command"].to_string_view());
+    mCommandTemplate = command_template{mCommand};
+  }
 
   if (configuration.contains("environment"))
-    mEnvironment = string_list_from(configuration["environment"]);
+  {
+    auto environment = std::make_shared<process::environment>();
+    for (auto entry: string_list_from(configuration["environment"]))
+      environment->set(entry);
+
+    mEnvironment = std::move(environment);
+  }
+
+  if (configuration.contains("filter"))
+    mFilter = filter{configuration["filter"].to_string_view()};
 
   if (configuration.contains("timeout"))
     mTimeout = std::chrono::seconds{configuration["timeout"].to<std::chrono::seconds::rep>()};
 
+  if (configuration.contains("skip_if_done_for"))
+  {
+    mSkipIfDoneFor = strings_from(configuration["skip_if_done_for"]);
+    for (auto variable: mSkipIfDoneFor)
+      if (std::find(std::begin(eventVariables), std::end(eventVariables), variable) == std::end(eventVariables)
+          && (!mEnvironment || mEnvironment->value(variable).empty()))
+        throw std::runtime_error{"skip_if_done_for: unknown variable " + std::string{variable}};
+  }
+
+  if (configuration.contains("payload"))
+  {
+    auto payload = configuration["payload"].to_string();
+    if (payload == "stdin")
+      mPayload = process::input_channel::pipe;
+    else if (payload == "memfd")
+      mPayload = process::input_channel::memfd;
+    else
+      throw std::runtime_error{"invalid payload channel " + payload};
+  }
+
+  if (configuration.contains("batch_window"))
+  {
+    std::size_t batchMax = 0;
+    if (configuration.contains("batch_max"))
+      batchMax = static_cast<std::size_t>(configuration["batch_max"].to_int_range(1, 100000));
+
+    std::chrono::seconds window{configuration["batch_window"].to_int_range(1, 24 * 3600)};
+    mBatch = std::make_unique<batch>(*this, window, batchMax);
+  }
+
   bool needUser = !mCommand.empty() && getuid() == 0;
   if (configuration.contains("run_as") || needUser)
     mUserGroup = user_group_from(configuration["run_as"]);
@@ -121,58 +326,112 @@ void hook::chain(std::unique_ptr<hook> other) noexcept
 
 
 
-void hook::operator()(http::request request) const
+/// Forgets the id of an event in the event_cache on destruction, unless the
+/// event was processed. So Gitlab can deliver the event again if its request
+/// fails, or its connection closes before the content is complete.
+class event_id_guard
 {
-  ++hooksRequests;
+  public:
+    explicit event_id_guard(std::string_view id)
+      : mId{id}
+    {}
+
+    ~event_id_guard()
+    {
+      if (!mId.empty())
+        event_cache::forget(mId);
+    }
+
+    void release() noexcept
+    { mId.clear(); }
+
+  private:
+    std::string mId;
+};
 
+
+
+void hook::operator()(http::request request) const
+{
+  io_context::set_subject(uri_path);
   auto peerAddress = to_string(request.peer_address());
   if (peerAddress.empty())
     throw std::runtime_error{"failed to obtain peer address"};
 
   if (request.method() != http::method::post)
+  {
+    ++stats().rejected;
     return request.respond(http::code::method_not_allowed, "method not allowed");
+  }
 
   if (request.path() != uri_path)
+  {
+    ++stats().rejected;
     return request.respond(http::code::not_found, "not found");
+  }
 
   auto reqToken = request.header("X-Gitlab-Token");
   if (reqToken.empty())
+  {
+    ++stats().rejected;
     return request.respond(http::code::unauthorized, "unauthorized");
+  }
 
-  bool allowed = false;
-  for (const hook* iter = this; iter; iter = iter->mChain.get())
-    if (iter->mToken == reqToken)
-      if (iter->mAllowedAddress.empty() || peerAddress == iter->mAllowedAddress)
-        allowed = true;
-
-  if (!allowed)
+  if (!authorizes(reqToken, peerAddress))
+  {
+    ++stats().rejected;
     return request.respond(http::code::forbidden, "forbidden");
+  }
 
-  request.accept([this, peerAddress = std::move(peerAddress)](http::request request) noexcept
+  ++stats().received;
+
+  auto eventId = request.header("X-Gitlab-Event-UUID");
+  if (!eventId.empty() && event_cache::contains(eventId))
   {
-    try {
-      ++hooksGoodRequests;
+    log_info("ignored duplicate event %.*s from %s to %s",
+             static_cast<int>(eventId.size()), eventId.data(), peerAddress.c_str(), uri_path.c_str());
+    return request.respond(http::code::ok, "duplicate");
+  }
 
+  // Redeliveries that arrive while the content is still received are duplicates, too.
+  std::shared_ptr<event_id_guard> eventIdGuard;
+  if (!eventId.empty())
+  {
+    event_cache::remember(eventId);
+    eventIdGuard = std::make_shared<event_id_guard>(eventId);
+  }
+
+  trace span{eventId, uri_path, request.received()};
+  span.mark(trace::stage::accepted);
+
+  request.accept([this, peerAddress = std::move(peerAddress), span = std::move(span), eventIdGuard = std::move(eventIdGuard)]
+                 (http::request request) mutable noexcept
+  {
+    io_context::set_subject(uri_path);
+    span.mark(trace::stage::body_complete);
+    capture_file::append(request, peerAddress);
+
+    try {
       auto reqToken = request.header("X-Gitlab-Token");
       auto json     = nlohmann::json::parse(request.content());
-      int  count    = 0;
+      auto content  = std::make_shared<const std::string>(request.release_content());
 
-      log_request(request, peerAddress, json);
+      span.mark(trace::stage::parsed);
+      span.set_source(peerAddress, projectPathFrom(json), pipelineIdFrom(json));
 
-      for (const hook* iter = this; iter; iter = iter->mChain.get())
-        if (iter->mToken == reqToken)
-          if (iter->mAllowedAddress.empty() || peerAddress == iter->mAllowedAddress)
-            switch (iter->process(request, json))
-            {
-              case outcome::stop:     return;
-              case outcome::ignored:  continue;
-              case outcome::accepted: ++count; continue;
-            }
+      auto fields = span.fields();
+      log_scope scope{fields};
+      log_request(request, peerAddress, json, span);
+      auto count = dispatch(event{request.header("X-Gitlab-Event"), json, std::move(content), &span}, reqToken, peerAddress);
+      if (eventIdGuard)
+        eventIdGuard->release();
 
       if (count)
         return request.respond(http::code::accepted, "accepted");
-      else
-        return request.respond(http::code::no_content, "ignored");
+
+      span.set_hook({});
+      span.finish("ignored");
+      return request.respond(http::code::no_content, "ignored");
     }
     catch (const nlohmann::json::exception& e)
     {
@@ -189,6 +448,57 @@ void hook::operator()(http::request request) const
 
 
 
+bool hook::authorizes(std::optional<std::string_view> token, std::string_view peerAddress) const noexcept
+{
+  for (const hook* iter = this; iter; iter = iter->mChain.get())
+    if (!token || iter->mToken == *token)
+      if (iter->mAllowedAddress.empty() || peerAddress == iter->mAllowedAddress)
+        return true;
+
+  return false;
+}
+
+
+
+std::size_t hook::dispatch(const event& event, std::optional<std::string_view> token, std::string_view peerAddress) const
+{
+  trace none;
+  auto& span   = event.span ? *event.span : none;
+  auto  fields = span.fields();
+  log_scope scope{fields};
+  std::size_t count = 0;
+
+  for (const hook* iter = this; iter; iter = iter->mChain.get())
+    if (!token || iter->mToken == *token)
+      if (iter->mAllowedAddress.empty() || peerAddress == iter->mAllowedAddress)
+      {
+        auto& stats = iter->stats();
+        ++stats.requests;
+        io_context::set_subject(iter->name);
+        fields.hookName = iter->name;
+
+        if (!iter->mFilter.matches(event.json))
+        {
+          log_debug("hook '%s' does not match the filter", iter->name.c_str());
+          ++stats.ignored;
+          continue;
+        }
+
+        span.set_hook(iter->name);
+        span.mark(trace::stage::dispatched);
+
+        switch (iter->process(event))
+        {
+          case outcome::ignored:  ++stats.ignored; continue;
+          case outcome::accepted: ++stats.accepted; ++count; continue;
+        }
+      }
+
+  return count;
+}
+
+
+
 std::string hook::to_string(const sockaddr* addr)
 {
   if (!addr)
@@ -214,7 +524,7 @@ std::string hook::to_string(const sockaddr* addr)
 
 
 
-void hook::log_request(http::request request, const std::string& peerAddress, const nlohmann::json& json) const
+void hook::log_request(http::request request, const std::string& peerAddress, const nlohmann::json& json, const trace& span) const
 {
   auto reqEvent = request.header("X-Gitlab-Event");
   if (reqEvent.empty())
@@ -224,43 +534,18 @@ void hook::log_request(http::request request, const std::string& peerAddress, co
   if (json.contains("project"))
     project = json["project"].at("web_url").get_ref<const std::string&>().c_str();
 
-  log_info("received '%.*s' from %s to %s for project %s",
-           static_cast<int>(reqEvent.size()), reqEvent.data(),
+  log_info("received '%.*s' event %s from %s to %s for project %s",
+           static_cast<int>(reqEvent.size()), reqEvent.data(), span.id().c_str(),
            peerAddress.c_str(), uri_path.c_str(), project);
 }
 
 
 
-static std::string_view split_command(std::string_view command, std::vector<std::string>& args)
-{
-  auto space = command.find_first_of(" \t");
-  if (space == command.npos)
-    return command;
-
-  auto result = command.substr(0, space);
-  for (;;)
-  {
-    auto next = command.find_first_not_of(" \t", space);
-    if (next == command.npos)
-      break;
-
-    command = command.substr(next);
-    space   = command.find_first_of(" \t");
-
-    args.push_back(std::string{command.substr(0, space)});
-    if (space == command.npos)
-      break;
-  }
-
-  return result;
-}
-
-
-
-auto hook::execute(http::request, const nlohmann::json& json, process::environment environment) const -> outcome
+auto hook::execute(const event& event, process::environment environment) const -> outcome
 {
   if (!mCommand.empty())
   {
+    auto& json = event.json;
     auto& json_project = json.at("project");
     environment.set("CI_PROJECT_ID", std::to_string(json_project.at("id").get<int>()));
     environment.set("CI_PROJECT_PATH", json_project.at("path_with_namespace").get_ref<const std::string&>());
@@ -268,21 +553,50 @@ auto hook::execute(http::request, const nlohmann::json& json, process::environme
     environment.set("CI_PROJECT_URL", json_project.at("web_url").get_ref<const std::string&>());
     environment.set("CI_SERVER_URL", gitlabServerFrom(json));
 
-    for (auto& entry: mEnvironment)
-      environment.set(entry);
+    environment.set_base(mEnvironment);
+
+    auto span = event.span ? *event.span : trace{};
+    auto doneKey = doneKeyFor(environment);
+    if (!doneKey.empty() && completion_store::contains(doneKey))
+    {
+      log_info("hook '%s' skipped, cached completion", name.c_str());
+      span.finish("cached");
+      return outcome::accepted;
+    }
 
-    std::vector<std::string> args;
-    auto program = split_command(mCommand, args);
+    if (span)
+    {
+      environment.set("GITLAB_HOOK_EVENT_ID", span.id());
+      span.mark(trace::stage::enqueued);
+    }
+
+    std::shared_ptr<const std::string> payload;
+    if (mPayload != process::input_channel::none && event.content)
+    {
+      bool pipe = mPayload == process::input_channel::pipe;
+      environment.set("GITLAB_HOOK_PAYLOAD_FD", std::to_string(pipe ? STDIN_FILENO : process::memfd_descriptor));
+      payload = event.content;
+    }
 
-    class process proc{action_list::get_io_context()};
-    proc.set_program(std::string{program});
-    proc.set_arguments(std::move(args));
-    proc.set_environment(std::move(environment));
-    proc.set_user_group(mUserGroup);
-    action_list::append(name.c_str(), std::move(proc), mTimeout);
+    if (event.dryRun)
+    {
+      std::vector<const char*> argv;
+      mCommandTemplate.expand(json, environment)->get(argv);
+
+      std::string commandLine;
+      for (std::size_t i = 0; argv[i]; ++i)
+        commandLine.append(i ? " " : "").append(argv[i]);
+
+      log_info("hook '%s' would execute %s", name.c_str(), commandLine.c_str());
+    }
+    else if (mBatch)
+      mBatch->add(mCommandTemplate.bind(json), std::move(environment), std::move(payload), std::move(span), std::move(doneKey));
+    else
+    {
+      auto command = mCommandTemplate.expand(json, environment);
+      schedule(std::move(command), std::move(environment), std::move(payload), std::move(span), {std::move(doneKey)});
+    }
 
-    ++hooksScheduled;
-    log_debug("scheduled hook '%s'", name.c_str());
     return outcome::accepted;
   }
   else
@@ -291,17 +605,143 @@ auto hook::execute(http::request, const nlohmann::json& json, process::environme
 
 
 
-auto hook::execute(http::request, std::function<void()> function) const -> outcome
+void hook::schedule(std::shared_ptr<const process::command_line> command, process::environment environment,
+                    std::shared_ptr<const std::string> payload, trace span, std::vector<std::string> doneKeys) const
 {
-  action_list::append(name.c_str(), std::move(function));
+  class process proc{action_list::get_io_context()};
+  proc.set_command_line(std::move(command));
+  proc.set_environment(std::move(environment));
+  proc.set_user_group(mUserGroup);
+  proc.set_input(std::move(payload), mPayload);
+
+  std::function<void(bool)> finished;
+  std::erase(doneKeys, std::string{});
+  if (!doneKeys.empty())
+    finished = [doneKeys = std::move(doneKeys)](bool succeeded)
+    {
+      if (succeeded)
+        for (auto& key: doneKeys)
+          completion_store::record(key);
+    };
 
-  ++hooksScheduled;
+  action_list::append(mStatsId, std::move(proc), mTimeout, std::move(span), std::move(finished));
+  ++stats().scheduled;
+  log_debug("scheduled hook '%s'", name.c_str());
+}
+
+
+
+std::string hook::doneKeyFor(const process::environment& environment) const
+{
+  if (mSkipIfDoneFor.empty())
+    return {};
+
+  // Hook name and values, separated by a character that none of them contains.
+  std::string result{name};
+  for (auto variable: mSkipIfDoneFor)
+  {
+    // Otherwise all events without the variable would share one key.
+    auto value = environment.value(variable);
+    if (value.empty())
+    {
+      log_debug("hook '%s' does not cache completion, %.*s is not set",
+                name.c_str(), static_cast<int>(variable.size()), variable.data());
+      return {};
+    }
+
+    result.push_back('\0');
+    result.append(value);
+  }
+
+  return result;
+}
+
+
+
+auto hook::execute(const event& event, std::function<void()> function) const -> outcome
+{
+  if (event.dryRun)
+  {
+    log_info("hook '%s' would execute", name.c_str());
+    return outcome::accepted;
+  }
+
+  auto span = event.span ? *event.span : trace{};
+  span.mark(trace::stage::enqueued);
+  action_list::append(mStatsId, std::move(function), std::move(span));
+  ++stats().scheduled;
   log_debug("scheduled hook '%s'", name.c_str());
   return outcome::accepted;
 }
 
 
 
+std::vector<std::string_view> hook::strings_from(config::item configuration)
+{
+  std::vector<std::string_view> result;
+
+  if (configuration.is_string())
+    result.push_back(configuration.to_string_view());
+  else
+    for (size_t i = 0, endi = configuration.size(); i != endi; ++i)
+      result.push_back(configuration[i].to_string_view());
+
+  return result;
+}
+
+
+
+pattern_set hook::patterns_from(config::item configuration)
+{
+  pattern_set result;
+  for (auto pattern: strings_from(configuration))
+    if (pattern.size() > 1 && pattern.starts_with('/') && pattern.ends_with('/'))
+      result.add_regex(pattern.substr(1, pattern.size() - 2));
+    else
+      result.add_glob(pattern);
+
+  result.compile();
+  return result;
+}
+
+
+
+std::string_view hook::projectPathFrom(const nlohmann::json& json)
+{
+  auto project = json.find("project");
+  if (project == json.end() || !project->is_object())
+    return {};
+
+  auto path = project->find("path_with_namespace");
+  if (path == project->end() || !path->is_string())
+    return {};
+
+  return path->get_ref<const std::string&>();
+}
+
+
+
+std::string hook::pipelineIdFrom(const nlohmann::json& json)
+{
+  if (!json.is_object())
+    return {};
+
+  if (json.value("object_kind", "") == "pipeline")
+  {
+    auto attrs = json.find("object_attributes");
+    if (attrs != json.end() && attrs->is_object() && attrs->contains("id") && (*attrs)["id"].is_number_unsigned())
+      return std::to_string((*attrs)["id"].get<uint64_t>());
+  }
+
+  auto id = json.find("pipeline_id");
+  if (id != json.end() && id->is_number_unsigned())
+    return std::to_string(id->get<uint64_t>());
+
+  return {};
+}
+
+
+
 std::string_view hook::gitlabServerFrom(const nlohmann::json& json)
 {
   std::string_view projectUrl = json.at("project").at("web_url").get_ref<const std::string&>();
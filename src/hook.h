@@ -16,11 +16,17 @@
     with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include "command_template.h"
 #include "config.h"
+#include "filter.h"
 #include "http_server.h"
+#include "metrics.h"
+#include "pattern.h"
 #include "process.h"
+#include "trace.h"
 #include "user_group.h"
 #include <nlohmann/json_fwd.hpp>
+#include <optional>
 
 
 
@@ -31,22 +37,13 @@ class hook
     /// Initializes configuration for all hooks.
     static void init_global(config::item configuration);
 
+    /// Schedules the commands for the events that hooks with a batch window
+    /// are still collecting, without waiting for the windows to end.
+    static void flush_batches();
+
     /// Constructs a webhook from the given \a configuration.
     static std::unique_ptr<hook> create(config::item configuration);
 
-    /// The number of requests made to hooks since start of the program.
-    static size_t requestCount() noexcept
-    { return hooksRequests; }
-
-    /// The number of well-authorized requests made to hooks since start of the
-    /// program.
-    static size_t goodRequestCount() noexcept
-    { return hooksGoodRequests; }
-
-    /// The number of hooks scheduled since start of the program.
-    static size_t scheduledCount() noexcept
-    { return hooksScheduled; }
-
     /// Constructs the hook from the given \a configuration.
     explicit hook(config::item configuration);
 
@@ -55,46 +52,98 @@ class hook
     /// Forms a chain with an \a other hook with the same uri_path.
     void chain(std::unique_ptr<hook> other) noexcept;
 
+    /// A webhook event received from Gitlab.
+    struct event
+    {
+      std::string_view type;       ///< value of the X-Gitlab-Event header
+      const nlohmann::json& json;  ///< the parsed request content
+      std::shared_ptr<const std::string> content{};  ///< the raw request content, if available
+      trace* span{};       ///< traces the event, if set
+      bool dryRun{false};  ///< whether hooks only prepare their commands, instead of scheduling them
+    };
+
     /// Processes an incoming HTTP \a request.
     void operator()(http::request request) const;
 
+    /// Whether this hook or one chained to it authorizes a request with the
+    /// \a token from the \a peerAddress. If \a token is not set, only the
+    /// peer address is checked.
+    bool authorizes(std::optional<std::string_view> token, std::string_view peerAddress) const noexcept;
+
+    /// Processes the \a event with this hook and all hooks chained to it that
+    /// authorize the \a token and \a peerAddress, see authorizes(). Returns
+    /// the number of hooks that accepted it.
+    std::size_t dispatch(const event& event, std::optional<std::string_view> token, std::string_view peerAddress) const;
+
+    /// Converts the IPv4 or IPv6 address \a addr to a string. Returns an
+    /// empty string if \a addr is nullptr or of another address family.
+    static std::string to_string(const sockaddr* addr);
+
     const std::string& uri_path;
     const std::string& name;
 
   protected:
-    enum class outcome { stop = 1, ignored, accepted };
+    enum class outcome { ignored = 1, accepted };
 
-    /// Processes an incoming HTTP \a request, with its content already parsed
-    /// to \a json. Must generate a response if it returns outcome::stop,
-    /// in all other cases not. To be implemented in derived classes.
-    virtual outcome process(http::request request, const nlohmann::json& json) const = 0;
+    /// Processes an incoming webhook \a event. To be implemented in derived
+    /// classes.
+    virtual outcome process(const event& event) const = 0;
 
     /// Executes the hook's command with the given process \a environment for
-    /// the \a request. Amends the \a environment with information from the \a
-    /// request's \a json content.
-    outcome execute(http::request request, const nlohmann::json& json, process::environment environment) const;
+    /// the \a event. Amends the \a environment with information from the \a
+    /// event's json content.
+    outcome execute(const event& event, process::environment environment) const;
+
+    /// Executes the \a function for the \a event, instead of a command.
+    outcome execute(const event& event, std::function<void()> function) const;
 
-    /// Executes the \a function for the \a request, instead of a command.
-    outcome execute(http::request request, std::function<void()> function) const;
+    /// The string or array of strings of the \a configuration entry.
+    static std::vector<std::string_view> strings_from(config::item configuration);
+
+    /// The patterns of the \a configuration entry, see strings_from(),
+    /// compiled into one automaton. Strings enclosed in slashes, like
+    /// "/^build-.*:/", are regular expressions, all others globs.
+    static pattern_set patterns_from(config::item configuration);
 
   private:
     hook(const hook&) = delete;
     hook& operator=(const hook&) = delete;
 
-    static std::string to_string(const sockaddr* addr);
     static std::string_view gitlabServerFrom(const nlohmann::json& json);
-    static size_t hooksRequests;
-    static size_t hooksGoodRequests;
-    static size_t hooksScheduled;
+    static std::string_view projectPathFrom(const nlohmann::json& json);
+    static std::string pipelineIdFrom(const nlohmann::json& json);
+
+    /// Schedules the \a command with the given process \a environment and
+    /// the \a payload for its input, traced by the \a span. Records the \a
+    /// doneKeys in the completion_store if the command succeeds.
+    void schedule(std::shared_ptr<const process::command_line> command, process::environment environment,
+                  std::shared_ptr<const std::string> payload, trace span, std::vector<std::string> doneKeys) const;
+
+    /// The key of the event with the process \a environment for the
+    /// completion_store, or an empty string if the hook has no
+    /// skip_if_done_for entry.
+    std::string doneKeyFor(const process::environment& environment) const;
+
+    hook_stats& stats() const noexcept
+    { return metrics::hook(mStatsId); }
 
     hook* findMatchingHookInChain(http::request request, const std::string& peerAddress) noexcept;
-    void log_request(http::request request, const std::string& peerAddress, const nlohmann::json& json) const;
+    void log_request(http::request request, const std::string& peerAddress, const nlohmann::json& json, const trace& span) const;
+
+    /// The events collected during a batch window.
+    struct batch;
 
     std::unique_ptr<hook> mChain;
     std::string_view mAllowedAddress;
     std::string_view mToken;
     std::string_view mCommand;
-    std::vector<std::string_view> mEnvironment;
+    command_template mCommandTemplate;                         ///< mCommand parsed
+    std::shared_ptr<const process::environment> mEnvironment;  ///< the "environment" entries
+    std::vector<std::string_view> mSkipIfDoneFor;
+    process::input_channel mPayload{process::input_channel::none};
+    filter mFilter;
     std::chrono::seconds mTimeout{60};
+    std::unique_ptr<batch> mBatch;
     user_group mUserGroup;
+    std::size_t mStatsId;
 };
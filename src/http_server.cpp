@@ -18,6 +18,7 @@
 #include "http_server.h"
 #include "io_context.h"
 #include "log.h"
+#include "metrics.h"
 #include <arpa/inet.h>
 #include <cassert>
 #include <cstring>
@@ -25,20 +26,11 @@
 #include <map>
 #include <microhttpd.h>
 #include <optional>
+#include <unistd.h>
 using namespace std::chrono_literals;
 
 
 
-struct free_event
-{
-  constexpr free_event() noexcept = default;
-
-  void operator()(event* p) noexcept
-  { event_free(p); }
-};
-
-
-
 struct delete_response
 {
   constexpr delete_response() noexcept = default;
@@ -60,11 +52,13 @@ struct http::server::impl
   std::string privateKey;
   std::optional<in_addr> address;
   uint16_t port{80};
+  int listenFd{-1};
   int maxConns{0};
   int maxConnsPerIp{0};
   int connTimeout{0};
   std::intptr_t memLimit{0};
   std::size_t contentLimit{SIZE_MAX};
+  bool rejecting{false};
   std::map<std::string,handler_type,std::less<>> handlers;
 
   static void eventCb(int fd, short what, void* cls) noexcept;
@@ -76,6 +70,7 @@ struct http::server::impl
   MHD_Result sendStaticResponse(MHD_Connection* conn, http::code code, std::string_view content) noexcept;
   std::pair<request::impl*,MHD_Result> newRequest(MHD_Connection* conn, const char* url, const char* method);
   MHD_Result completeRequest(request::impl* request, MHD_Connection* conn);
+  MHD_Result queueResponse(request::impl* request, MHD_Connection* conn);
   const handler_type* findHandler(std::string_view path) const noexcept;
 };
 
@@ -98,12 +93,26 @@ struct http::request::impl
   std::string responseBody;
   size_t contentLimit;
   http::code responseCode;
+  std::chrono::steady_clock::time_point received;
 
   MHD_Result addContent(const char* upload, std::size_t size) noexcept;
 };
 
 
 
+struct body_generator
+{
+  http::request::generator_type generate;
+  std::string buffer;
+  std::size_t offset{0};
+  bool finished{false};
+
+  static ssize_t readCb(void* cls, uint64_t pos, char* buf, size_t max) noexcept;
+  static void freeCb(void* cls) noexcept;
+};
+
+
+
 http::server::server(io_context& context)
   : m{new impl{context}}
 {}
@@ -148,6 +157,25 @@ void http::server::set_port(std::uint16_t port) noexcept
 
 
 
+void http::server::set_listen_socket(int fd) noexcept
+{
+  assert(!m->daemon);
+  m->listenFd = fd;
+}
+
+
+
+int http::server::listen_socket() const noexcept
+{
+  if (!m->daemon)
+    return -1;
+
+  auto info = MHD_get_daemon_info(m->daemon, MHD_DAEMON_INFO_LISTEN_FD);
+  return info ? info->listen_fd : -1;
+}
+
+
+
 void http::server::set_local_cert(std::string certificate) noexcept
 {
   assert(!certificate.empty());
@@ -265,10 +293,12 @@ void http::server::start()
   if (!m->localCert.empty())
     flags |= MHD_USE_TLS;
 
-  server_options<8> options;
+  server_options<9> options;
   sockaddr_in address;
 
-  if (m->address)
+  if (m->listenFd != -1)
+    options.set(MHD_OPTION_LISTEN_SOCKET, m->listenFd);
+  else if (m->address)
   {
     memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
@@ -304,11 +334,13 @@ void http::server::start()
   if (!m->daemon)
     throw std::runtime_error("failed to start HTTP server");
 
+  m->listenFd = -1;  // owned by daemon now
+
   auto info = MHD_get_daemon_info(m->daemon, MHD_DAEMON_INFO_EPOLL_FD);
   if (!info)
     throw std::runtime_error{"HTTP server library does not support epoll"};
 
-  m->listener.reset(event_new(m->io.native_handle(), info->epoll_fd, EV_TIMEOUT|EV_READ, &impl::eventCb, m.get()));
+  m->listener.reset(m->io.new_event<&impl::eventCb>(info->epoll_fd, EV_TIMEOUT|EV_READ, m.get(), "http::server::eventCb"));
   m->listen();
 }
 
@@ -338,6 +370,23 @@ void http::server::impl::eventCb(int, short /*what*/, void* cls) noexcept
 
 
 
+void http::server::quiesce() noexcept
+{
+  if (!m->daemon)
+    return;
+
+  auto fd = MHD_quiesce_daemon(m->daemon);
+  if (fd != MHD_INVALID_SOCKET)
+    close(fd);
+}
+
+
+
+void http::server::reject_requests(bool reject) noexcept
+{ m->rejecting = reject; }
+
+
+
 void http::server::stop() noexcept
 {
   m->listener.reset();
@@ -394,6 +443,9 @@ auto http::server::impl::newRequest(MHD_Connection* conn, const char* url, const
 {
   log_debug("received HTTP %s %s", method, url);
 
+  if (rejecting)
+    return {nullptr, sendStaticResponse(conn, http::code::service_unavailable, "service unavailable")};
+
   auto httpMethod = methodFrom(method);
   if (httpMethod == http::method{})
     return {nullptr, sendStaticResponse(conn, http::code::method_not_allowed, "method not allowed")};
@@ -407,6 +459,7 @@ auto http::server::impl::newRequest(MHD_Connection* conn, const char* url, const
   request->method       = httpMethod;
   request->url          = url;
   request->contentLimit = contentLimit;
+  request->received     = std::chrono::steady_clock::now();
 
   handler->operator()(http::request{request.get()});
 
@@ -416,7 +469,7 @@ auto http::server::impl::newRequest(MHD_Connection* conn, const char* url, const
     case request::state::created:   result = MHD_NO; break;  // handler did nothing
     case request::state::accepted:  result = MHD_YES; break;
     case request::state::completed: assert(false); result = MHD_NO; break;
-    case request::state::responded: result = MHD_queue_response(conn, static_cast<uint>(request->responseCode), request->response.get()); break;
+    case request::state::responded: result = queueResponse(request.get(), conn); break;
   }
 
   return {request.release(), result};
@@ -437,7 +490,7 @@ MHD_Result http::server::impl::completeRequest(request::impl* request, MHD_Conne
     case request::state::created:
     case request::state::accepted:  assert(false); result = MHD_NO; break;
     case request::state::completed: result = MHD_NO; break;  // handler did nothing
-    case request::state::responded: result = MHD_queue_response(conn, static_cast<uint>(request->responseCode), request->response.get()); break;
+    case request::state::responded: result = queueResponse(request, conn); break;
   }
 
   return result;
@@ -445,6 +498,20 @@ MHD_Result http::server::impl::completeRequest(request::impl* request, MHD_Conne
 
 
 
+MHD_Result http::server::impl::queueResponse(request::impl* request, MHD_Connection* conn)
+{
+  metrics::count_response(request->responseCode);
+  metrics::requestTime.observe(std::chrono::steady_clock::now() - request->received);
+  return MHD_queue_response(conn, static_cast<uint>(request->responseCode), request->response.get());
+}
+
+
+
+auto http::server::find_handler(std::string_view path) const noexcept -> const handler_type*
+{ return m->findHandler(path); }
+
+
+
 auto http::server::impl::findHandler(std::string_view path) const noexcept -> const handler_type*
 {
   if (path.empty() || path.front() != '/')
@@ -482,6 +549,7 @@ MHD_Result http::server::impl::sendStaticResponse(MHD_Connection* conn, http::co
   }
 
   log_debug("respond HTTP %i", static_cast<int>(code));
+  metrics::count_response(code);
   auto result = MHD_queue_response(conn, static_cast<uint>(code), response);
   MHD_destroy_response(response); // decrements refcount
   return result;
@@ -533,6 +601,19 @@ std::string_view http::request::header(const char* key) const noexcept
 
 
 
+void http::request::for_each_header(const header_visitor& visitor) const
+{
+  auto iterator = [](void* cls, MHD_ValueKind, const char* key, const char* value) -> MHD_Result
+  {
+    (*static_cast<const header_visitor*>(cls))(key, value ? value : std::string_view{});
+    return MHD_YES;
+  };
+
+  MHD_get_connection_values(m->conn, MHD_HEADER_KIND, iterator, const_cast<header_visitor*>(&visitor));
+}
+
+
+
 std::string_view http::request::query(const char* key) const noexcept
 {
   const char* result = MHD_lookup_connection_value(m->conn, MHD_GET_ARGUMENT_KIND, key);
@@ -549,6 +630,18 @@ const std::string& http::request::content() const noexcept
 }
 
 
+std::string http::request::release_content() noexcept
+{
+  assert(m->method == method::put || m->method == method::post);
+  assert(m->state == state::completed);
+  return std::move(m->content);
+}
+
+
+std::chrono::steady_clock::time_point http::request::received() const noexcept
+{ return m->received; }
+
+
 
 void http::request::accept(handler_type handler) noexcept
 {
@@ -609,3 +702,57 @@ void http::request::respond_static(http::code code, std::string_view body)
 
   log_debug("respond HTTP %i", static_cast<int>(code));
 }
+
+
+
+void http::request::respond(http::code code, const char* contentType, generator_type generator)
+{
+  assert(!m->response);
+
+  auto body = std::make_unique<body_generator>();
+  body->generate = std::move(generator);
+
+  m->response.reset(MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4096, &body_generator::readCb, body.get(), &body_generator::freeCb));
+  if (!m->response)
+    throw std::runtime_error{"failed to create HTTP response"};
+
+  body.release();  // owned by response now
+  MHD_add_response_header(m->response.get(), MHD_HTTP_HEADER_CONTENT_TYPE, contentType);
+
+  m->responseCode = code;
+  m->state        = state::responded;
+
+  log_debug("respond HTTP %i", static_cast<int>(code));
+}
+
+
+
+ssize_t body_generator::readCb(void* cls, uint64_t, char* buf, size_t max) noexcept
+try {
+  auto self = static_cast<body_generator*>(cls);
+  while (self->offset == self->buffer.size())
+  {
+    if (self->finished)
+      return MHD_CONTENT_READER_END_OF_STREAM;
+
+    self->buffer.clear();
+    self->offset   = 0;
+    self->finished = !self->generate(self->buffer);
+  }
+
+  auto count = std::min(max, self->buffer.size() - self->offset);
+  memcpy(buf, self->buffer.data() + self->offset, count);
+  self->offset += count;
+
+  return static_cast<ssize_t>(count);
+}
+catch (const std::exception& e)
+{
+  log_error("exception in HTTP response generator: %s", e.what());
+  return MHD_CONTENT_READER_END_WITH_ERROR;
+}
+
+
+
+void body_generator::freeCb(void* cls) noexcept
+{ delete static_cast<body_generator*>(cls); }
@@ -63,7 +63,9 @@ enum class code
 class request
 {
   public:
-    using handler_type = std::function<void(request)>;
+    using handler_type   = std::function<void(request)>;
+    using generator_type = std::function<bool(std::string&)>;
+    using header_visitor = std::function<void(std::string_view name, std::string_view value)>;
 
     /// The address of the peer. May be nullptr.
     const sockaddr* peer_address() const noexcept;
@@ -75,6 +77,10 @@ class request
     /// present in this request.
     std::string_view header(const char* key) const noexcept;
 
+    /// Invokes the \a visitor with name and value of each HTTP header entry,
+    /// in the order they were received.
+    void for_each_header(const header_visitor& visitor) const;
+
     /// The URI-Path of the request.
     std::string_view path() const noexcept;
 
@@ -85,6 +91,12 @@ class request
     /// The body of a PUT or POST request.
     const std::string& content() const noexcept;
 
+    /// Moves the content() out of the request, which is empty afterwards.
+    std::string release_content() noexcept;
+
+    /// The time when the server received the request's header.
+    std::chrono::steady_clock::time_point received() const noexcept;
+
     /// Accepts a PUT or POST request and starts receiving its content(). After
     /// the content has been received, invokes the \a handler to finish the
     /// request.
@@ -100,6 +112,13 @@ class request
     /// \a body.
     void respond(http::code code, std::string&& body);
 
+    /// Sends a response to this request with given HTTP response \a code and
+    /// \a contentType, and a body produced piecewise by the \a generator
+    /// whenever the connection is ready to send more data. The generator
+    /// appends the next piece of the body to its argument and returns false
+    /// after the last piece.
+    void respond(http::code code, const char* contentType, generator_type generator);
+
     struct impl;
     enum class state;
     explicit request(impl* pimpl) noexcept;
@@ -132,6 +151,14 @@ class server
     /// Configures the \a port on which the server listens for connections.
     void set_port(std::uint16_t port) noexcept;
 
+    /// Configures an already bound and listening socket \a fd for the server
+    /// to use, instead of opening its own port. The server takes ownership of
+    /// the socket.
+    void set_listen_socket(int fd) noexcept;
+
+    /// The listening socket of the running server, or -1.
+    int listen_socket() const noexcept;
+
     /// Sets the server \a certificate and enables HTTPS. The buffer must be in
     /// PEM format.
     void set_local_cert(std::string certificate) noexcept;
@@ -165,9 +192,22 @@ class server
     /// it, except if there is a more specified handler for that sub-path.
     void add_handler(std::string path, handler_type handler);
 
+    /// The handler that is invoked for requests to \a path, or nullptr if
+    /// there is none.
+    const handler_type* find_handler(std::string_view path) const noexcept;
+
     /// Starts the server, that is, opens the port and waits for requests.
     void start();
 
+    /// Stops accepting new connections, but continues to serve the open
+    /// ones. Closes the listening socket.
+    void quiesce() noexcept;
+
+    /// Responds to all new requests with HTTP status 503 "service
+    /// unavailable", for example while shutting down. Serves them again if
+    /// not \a reject.
+    void reject_requests(bool reject = true) noexcept;
+
     /// Stops the server and closes the port.
     void stop() noexcept;
 
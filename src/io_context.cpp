@@ -16,7 +16,11 @@
     with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
 */
 #include "io_context.h"
+#include "log.h"
+#include <algorithm>
+#include <cstring>
 #include <event2/event.h>
+#include <utility>
 
 
 
@@ -30,6 +34,11 @@ struct free_event_base
 
 
 
+void free_event::operator()(event* p) noexcept
+{ event_free(p); }
+
+
+
 struct io_context::impl
 {
   std::unique_ptr<event_base,free_event_base> base;
@@ -63,3 +72,143 @@ void io_context::run()
 
 void io_context::stop() noexcept
 { event_base_loopbreak(m->base.get()); }
+
+
+
+event* io_context::create_event(int fd, short what, callback_type callback, void* cls) noexcept
+{ return event_new(m->base.get(), fd, what, callback, cls); }
+
+
+
+using std::chrono::steady_clock;
+
+io_context::callback_profile* io_context::profiles = nullptr;
+
+static bool profilerEnabled{false};
+static std::chrono::microseconds profilerBudget{};
+static std::array<char,128> subject{};
+static std::size_t subjectSize{0};
+static std::array<char,128> slowestSubject{};
+static io_context::callback_info slowest;
+
+
+
+void io_context::enable_profiler(std::chrono::microseconds budget) noexcept
+{
+  profilerEnabled = true;
+  profilerBudget  = budget;
+}
+
+
+void io_context::disable_profiler() noexcept
+{ profilerEnabled = false; }
+
+
+bool io_context::profiling() noexcept
+{ return profilerEnabled; }
+
+
+
+void io_context::register_profile(callback_profile& profile, const char* name) noexcept
+{
+  if (profile.name)
+    return;
+
+  profile.name = name;
+  profile.next = profiles;
+  profiles     = &profile;
+}
+
+
+
+void io_context::set_subject(std::string_view text) noexcept
+{
+  if (!profilerEnabled)
+    return;
+
+  subjectSize = std::min(text.size(), subject.size());
+  memcpy(subject.data(), text.data(), subjectSize);
+}
+
+
+
+steady_clock::time_point io_context::begin_callback() noexcept
+{
+  subjectSize = 0;
+  return steady_clock::now();
+}
+
+
+
+void io_context::end_callback(callback_profile& profile, steady_clock::time_point start) noexcept
+{
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(steady_clock::now() - start);
+  auto usecs   = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+  std::size_t bucket = 0;
+  while (bucket + 1 < profile.buckets.size() && usecs >= (std::uint64_t{1} << bucket))
+    ++bucket;
+
+  ++profile.calls;
+  ++profile.buckets[bucket];
+  profile.total += elapsed;
+  profile.max    = std::max(profile.max, elapsed);
+
+  if (elapsed > slowest.duration)
+  {
+    memcpy(slowestSubject.data(), subject.data(), subjectSize);
+    slowest = {profile.name, {slowestSubject.data(), subjectSize}, elapsed};
+  }
+
+  if (elapsed > profilerBudget)
+  {
+    auto msecs = static_cast<double>(elapsed.count()) / 1e6;
+    if (subjectSize)
+      log_warning("callback %s took %.1f ms handling %.*s", profile.name, msecs, static_cast<int>(subjectSize), subject.data());
+    else
+      log_warning("callback %s took %.1f ms", profile.name, msecs);
+  }
+}
+
+
+
+io_context::callback_info io_context::slowest_callback() noexcept
+{ return std::exchange(slowest, {}); }
+
+
+
+/// Returns the upper bound of the bucket that contains the \a percent
+/// percentile of the \a profile's durations, in microseconds.
+static std::uint64_t percentile(const auto& profile, std::uint64_t percent) noexcept
+{
+  auto rank = (profile.calls * percent + 99) / 100;
+  std::uint64_t seen = 0;
+
+  for (std::size_t i = 0; i != profile.buckets.size(); ++i)
+    if ((seen += profile.buckets[i]) >= rank)
+      return std::uint64_t{1} << i;
+
+  return std::uint64_t{1} << (profile.buckets.size() - 1);
+}
+
+
+
+void io_context::dump_profile() noexcept
+{
+  if (!profiles)
+    return log_warning("callback profiler is not enabled");
+
+  log_warning("%-40s %10s %12s %10s %10s %10s %10s", "callback", "calls", "total[ms]", "avg[us]", "p50<[us]", "p99<[us]", "max[us]");
+  for (auto profile = profiles; profile; profile = profile->next)
+  {
+    using std::chrono::duration;
+    auto total = duration<double,std::milli>{profile->total}.count();
+    auto avg   = profile->calls ? duration<double,std::micro>{profile->total}.count() / static_cast<double>(profile->calls) : 0.0;
+    auto max   = duration<double,std::micro>{profile->max}.count();
+
+    log_warning("%-40s %10llu %12.1f %10.1f %10llu %10llu %10.1f", profile->name,
+                static_cast<unsigned long long>(profile->calls), total, avg,
+                static_cast<unsigned long long>(percentile(*profile, 50)),
+                static_cast<unsigned long long>(percentile(*profile, 99)), max);
+  }
+}
@@ -16,15 +16,32 @@
     with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <string_view>
+struct event;
 struct event_base;
 
 
 
+/// Deleter for std::unique_ptr of the events from io_context::new_event().
+struct free_event
+{
+  constexpr free_event() noexcept = default;
+  void operator()(event* p) noexcept;
+};
+
+
+
 /// Wrapper for libevent's event_base.
 class io_context
 {
   public:
+    /// Signature of libevent callback functions.
+    using callback_type = void (*)(int fd, short what, void* cls);
+
     io_context();
     event_base* native_handle() noexcept;
 
@@ -34,7 +51,65 @@ class io_context
     /// Stops the running event loop.
     void stop() noexcept;
 
+    /// Creates a libevent event like event_new() that invokes \a Callback.
+    /// If the profiler is enabled, the callback is timed under the given \a
+    /// name, which must be a string literal.
+    template<callback_type Callback>
+    event* new_event(int fd, short what, void* cls, const char* name);
+
+    /// Enables the callback profiler for the events created afterwards.
+    /// Callbacks that take longer than \a budget are logged.
+    static void enable_profiler(std::chrono::microseconds budget) noexcept;
+
+    /// Disables the callback profiler for the events created afterwards.
+    static void disable_profiler() noexcept;
+
+    /// Logs the table of callback counts and durations.
+    static void dump_profile() noexcept;
+
+    /// Sets the request or hook that the running callback is working on, for
+    /// the profiler's warnings about slow callbacks. Cleared for each callback.
+    static void set_subject(std::string_view subject) noexcept;
+
+    /// A callback timed by the profiler, see slowest_callback().
+    struct callback_info
+    {
+      const char* name{nullptr};   ///< name given to new_event(), or nullptr
+      std::string_view subject;    ///< see set_subject(), valid until the next callback ends
+      std::chrono::nanoseconds duration{};
+    };
+
+    /// The slowest callback since the last call. Empty unless the profiler is
+    /// enabled.
+    static callback_info slowest_callback() noexcept;
+
   private:
+    struct callback_profile
+    {
+      static constexpr std::size_t bucketCount = 24;
+
+      const char* name{nullptr};
+      callback_profile* next{nullptr};
+      std::uint64_t calls{0};
+      std::chrono::nanoseconds total{};
+      std::chrono::nanoseconds max{};
+      std::array<std::uint64_t,bucketCount> buckets{};  ///< durations below 2^i microseconds
+    };
+
+    static callback_profile* profiles;
+
+    template<callback_type Callback>
+    static inline callback_profile profile_of{};
+
+    template<callback_type Callback>
+    static void profiled_callback(int fd, short what, void* cls) noexcept;
+
+    event* create_event(int fd, short what, callback_type callback, void* cls) noexcept;
+    static bool profiling() noexcept;
+    static void register_profile(callback_profile& profile, const char* name) noexcept;
+    static std::chrono::steady_clock::time_point begin_callback() noexcept;
+    static void end_callback(callback_profile& profile, std::chrono::steady_clock::time_point start) noexcept;
+
     struct impl;
     struct impl_delete
     {
@@ -44,3 +119,25 @@ class io_context
 
     std::unique_ptr<impl,impl_delete> m;
 };
+
+
+
+template<io_context::callback_type Callback>
+void io_context::profiled_callback(int fd, short what, void* cls) noexcept
+{
+  auto start = begin_callback();
+  Callback(fd, what, cls);
+  end_callback(profile_of<Callback>, start);
+}
+
+
+
+template<io_context::callback_type Callback>
+event* io_context::new_event(int fd, short what, void* cls, const char* name)
+{
+  if (!profiling())
+    return create_event(fd, what, Callback, cls);
+
+  register_profile(profile_of<Callback>, name);
+  return create_event(fd, what, &profiled_callback<Callback>, cls);
+}
@@ -0,0 +1,88 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "job_hook.h"
+#include "log.h"
+#include <nlohmann/json.hpp>
+
+
+
+job_hook::job_hook(config::item configuration)
+  : hook{configuration},
+    mJobNames{patterns_from(configuration["job_name"])}
+{
+  if (configuration.contains("status"))
+    mStatuses = patterns_from(configuration["status"]);
+  else
+  {
+    mStatuses.add_literal("success");
+    mStatuses.compile();
+  }
+
+  if (configuration.contains("ref"))
+    mRefs = patterns_from(configuration["ref"]);
+}
+
+
+
+auto job_hook::process(const event& event) const -> outcome
+{
+  if (event.type != "Job Hook")
+    return outcome::ignored;
+
+  auto& json    = event.json;
+  auto& jobName = json.at("build_name").get_ref<const std::string&>();
+  if (!mJobNames.matches(jobName))
+  {
+    log_debug("hook '%s': no matching job name '%s'", name.c_str(), jobName.c_str());
+    return outcome::ignored;
+  }
+
+  auto& status = json.at("build_status").get_ref<const std::string&>();
+  if (!mStatuses.matches(status))
+  {
+    log_debug("hook '%s': no matching status '%s'", name.c_str(), status.c_str());
+    return outcome::ignored;
+  }
+
+  auto& ref = json.at("ref").get_ref<const std::string&>();
+  if (!mRefs.empty() && !mRefs.matches(ref))
+  {
+    log_debug("hook '%s': no matching ref '%s'", name.c_str(), ref.c_str());
+    return outcome::ignored;
+  }
+
+  auto jobId = std::to_string(json.at("build_id").get<uint64_t>());
+
+  // Also as lists, so that commands work for pipeline and job hooks alike.
+  process::environment environment;
+  environment.set("CI_JOB_ID", jobId);
+  environment.set("CI_JOB_IDS", jobId);
+  environment.set("CI_JOB_NAME", jobName);
+  environment.set("CI_JOB_NAMES", jobName);
+  environment.set("CI_JOB_STAGE", json.at("build_stage").get_ref<const std::string&>());
+  environment.set("CI_JOB_STATUS", status);
+  environment.set("CI_COMMIT_REF_NAME", ref);
+  environment.set("CI_COMMIT_SHA", json.at("sha").get_ref<const std::string&>());
+  environment.set("CI_PIPELINE_ID", std::to_string(json.at("pipeline_id").get<uint64_t>()));
+
+  auto tag = json.find("tag");
+  if (tag != json.end() && tag->is_boolean() && tag->get<bool>())
+    environment.set("CI_COMMIT_TAG", ref);
+
+  return execute(event, std::move(environment));
+}
@@ -0,0 +1,37 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "hook.h"
+
+
+
+/// A webhook for the Gitlab "job event", which Gitlab sends whenever the
+/// status of a single job changes.
+class job_hook : public hook
+{
+  public:
+    explicit job_hook(config::item configuration);
+
+  protected:
+    outcome process(const event& event) const override;
+
+  private:
+    pattern_set mJobNames;
+    pattern_set mStatuses;
+    pattern_set mRefs;
+};
@@ -16,15 +16,27 @@
     with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
 */
 #include "log.h"
+#include <atomic>
+#include <cassert>
+#include <cerrno>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sys/uio.h>
 #include <systemd/sd-daemon.h>
+#include <systemd/sd-journal.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
 
 
 
 static log_severity log_level{log_severity::warning};
 static bool log_systemd{false};
+static bool log_journal{false};
+static const log_fields* log_current_fields{nullptr};
 
 
 
@@ -34,6 +46,432 @@ void set_log_level(log_severity severity) noexcept
 void set_log_systemd(bool enabled) noexcept
 { log_systemd = enabled; }
 
+void set_log_journal(bool enabled) noexcept
+{ log_journal = enabled; }
+
+
+
+log_scope::log_scope(const log_fields& fields) noexcept
+  : mPrevious{std::exchange(log_current_fields, &fields)}
+{}
+
+
+log_scope::~log_scope()
+{ log_current_fields = mPrevious; }
+
+
+
+/// Kinds of records in the log_writer's ring buffer.
+enum class record_kind : std::uint32_t
+{ padding, text, journal };
+
+
+/// Header of a record in the log_writer's ring buffer. Text records contain
+/// a log line. Journal records contain the fields of a journal entry, each
+/// as 32-bit length followed by the "FIELD=value" string, padded to four
+/// bytes. Records are padded to eight bytes.
+struct record_header
+{
+  std::uint32_t size;
+  record_kind kind;
+};
+
+
+constexpr std::size_t padded(std::size_t size, std::size_t alignment) noexcept
+{ return (size + alignment - 1) & ~(alignment - 1); }
+
+
+
+/// Writes log messages from a background thread, so that a slow consumer of
+/// stderr or the journal does not block the event loop. Messages are passed
+/// in a lock-free ring buffer with a single producer, the event loop, and a
+/// single consumer, the writer thread. Messages that do not fit into the ring
+/// buffer are dropped and counted.
+class log_writer
+{
+  public:
+    static log_writer& instance();
+
+    char* reserve(record_kind kind, std::size_t size) noexcept;
+    void commit() noexcept;
+    void flush() noexcept;
+
+  private:
+    static constexpr std::size_t capacity   = 256 * 1024;
+    static constexpr std::size_t maxBatch   = 64;
+    static constexpr std::size_t maxFields  = 16;
+    static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+    log_writer();
+    void run() noexcept;
+    void writeText(iovec* iov, std::size_t count) noexcept;
+    void writeJournal(const char* data, std::size_t size) noexcept;
+    void reportDropped() noexcept;
+    void stop() noexcept;
+
+    std::unique_ptr<char[]> mBuffer{new char[capacity]};
+    std::atomic<std::size_t> mHead{0};      ///< written by producer
+    std::atomic<std::size_t> mTail{0};      ///< written by consumer
+    std::atomic<std::uint32_t> mWakeups{0};
+    std::atomic<std::uint64_t> mDropped{0};
+    std::atomic<bool> mStopping{false};
+    std::size_t mReserved{0};
+    bool mStopped{false};
+    const pid_t mPid{getpid()};
+    std::thread mThread;
+};
+
+
+
+log_writer& log_writer::instance()
+{
+  // NOTE: Never destroyed, because a forked child process exits without the
+  // writer thread. The parent stops the thread in an atexit() handler.
+  static log_writer* writer = []
+  {
+    auto result = new log_writer;
+    std::atexit([]{ instance().stop(); });
+    return result;
+  }();
+
+  return *writer;
+}
+
+
+
+log_writer::log_writer()
+  : mThread{[this]{ run(); }}
+{}
+
+
+
+char* log_writer::reserve(record_kind kind, std::size_t size) noexcept
+{
+  auto total = sizeof(record_header) + padded(size, 8);
+  auto head  = mHead.load(std::memory_order_relaxed);
+  auto tail  = mTail.load(std::memory_order_acquire);
+
+  auto offset  = head & (capacity - 1);
+  auto tillEnd = capacity - offset;
+  auto needed  = total > tillEnd ? total + tillEnd : total;
+
+  if (needed > capacity - (head - tail))
+  {
+    mDropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  if (total > tillEnd)
+  {
+    record_header padding{static_cast<std::uint32_t>(tillEnd - sizeof(record_header)), record_kind::padding};
+    memcpy(mBuffer.get() + offset, &padding, sizeof(padding));
+    head  += tillEnd;
+    offset = 0;
+  }
+
+  record_header header{static_cast<std::uint32_t>(size), kind};
+  memcpy(mBuffer.get() + offset, &header, sizeof(header));
+
+  mReserved = head + total;
+  return mBuffer.get() + offset + sizeof(header);
+}
+
+
+
+void log_writer::commit() noexcept
+{
+  if (mStopped)
+  {
+    // The writer thread is gone, process the records right here.
+    mHead.store(mReserved, std::memory_order_release);
+    mStopping.store(true, std::memory_order_relaxed);
+    return run();
+  }
+
+  mHead.store(mReserved, std::memory_order_release);
+  mWakeups.fetch_add(1, std::memory_order_release);
+  mWakeups.notify_one();
+}
+
+
+
+void log_writer::run() noexcept
+{
+  iovec batch[maxBatch];
+  for (;;)
+  {
+    auto wakeups = mWakeups.load(std::memory_order_acquire);
+    auto tail    = mTail.load(std::memory_order_relaxed);
+    auto head    = mHead.load(std::memory_order_acquire);
+
+    if (head == tail)
+    {
+      reportDropped();
+      if (mStopping.load(std::memory_order_acquire))
+        return;
+
+      mWakeups.wait(wakeups, std::memory_order_acquire);
+      continue;
+    }
+
+    std::size_t count = 0;
+    while (tail != head && count != maxBatch)
+    {
+      auto record = mBuffer.get() + (tail & (capacity - 1));
+      record_header header;
+      memcpy(&header, record, sizeof(header));
+
+      auto data = record + sizeof(header);
+      if (header.kind == record_kind::text)
+        batch[count++] = iovec{data, header.size};
+      else if (header.kind == record_kind::journal)
+      {
+        if (count)
+          break;  // keep the order of messages
+
+        writeJournal(data, header.size);
+      }
+
+      tail += sizeof(header) + padded(header.size, 8);
+      if (header.kind == record_kind::journal)
+        break;
+    }
+
+    writeText(batch, count);
+    mTail.store(tail, std::memory_order_release);
+    mTail.notify_all();
+  }
+}
+
+
+
+void log_writer::writeText(iovec* iov, std::size_t count) noexcept
+{
+  while (count)
+  {
+    auto written = writev(STDERR_FILENO, iov, static_cast<int>(count));
+    if (written == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return;  // nowhere to report this
+    }
+
+    auto remaining = static_cast<std::size_t>(written);
+    for (; count && remaining >= iov->iov_len; ++iov, --count)
+      remaining -= iov->iov_len;
+
+    if (count)
+    {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+      iov->iov_len -= remaining;
+    }
+  }
+}
+
+
+
+void log_writer::writeJournal(const char* data, std::size_t size) noexcept
+{
+  iovec fields[maxFields];
+  int count = 0;
+
+  for (std::size_t pos = 0; pos < size && count != maxFields;)
+  {
+    std::uint32_t length;
+    memcpy(&length, data + pos, sizeof(length));
+    fields[count++] = iovec{const_cast<char*>(data + pos + sizeof(length)), length};
+    pos += sizeof(length) + padded(length, 4);
+  }
+
+  sd_journal_sendv(fields, count);
+}
+
+
+
+void log_writer::reportDropped() noexcept
+{
+  auto dropped = mDropped.exchange(0, std::memory_order_relaxed);
+  if (!dropped)
+    return;
+
+  char message[80];
+  if (log_journal)
+  {
+    sd_journal_print(4, "dropped %llu log message(s)", static_cast<unsigned long long>(dropped));
+    return;
+  }
+
+  auto length = snprintf(message, sizeof(message), "%swarning: dropped %llu log message(s)\n",
+                         log_systemd ? SD_WARNING : "", static_cast<unsigned long long>(dropped));
+
+  iovec iov{message, static_cast<std::size_t>(length)};
+  writeText(&iov, 1);
+}
+
+
+
+void log_writer::flush() noexcept
+{
+  auto head = mHead.load(std::memory_order_relaxed);
+  for (auto tail = mTail.load(std::memory_order_acquire); tail != head; tail = mTail.load(std::memory_order_acquire))
+    mTail.wait(tail, std::memory_order_acquire);
+}
+
+
+
+void log_writer::stop() noexcept
+{
+  if (getpid() != mPid)
+    return;
+
+  mStopping.store(true, std::memory_order_release);
+  mWakeups.fetch_add(1, std::memory_order_release);
+  mWakeups.notify_one();
+  mThread.join();
+  mStopped = true;
+}
+
+
+
+/// A log message formatted with vsnprintf(), on the stack if it is short.
+class formatted_message
+{
+  public:
+    formatted_message(std::string_view prefix, const char* format, va_list args) noexcept;
+
+    /// The message including prefix and a trailing newline, or empty on
+    /// formatting errors.
+    std::string_view text() const noexcept
+    { return {mData, mSize}; }
+
+  private:
+    char mStackBuffer[1024];
+    std::unique_ptr<char[]> mHeapBuffer;
+    char* mData{mStackBuffer};
+    std::size_t mSize{0};
+};
+
+
+
+formatted_message::formatted_message(std::string_view prefix, const char* format, va_list args) noexcept
+{
+  memcpy(mData, prefix.data(), prefix.size());
+
+  va_list args2;
+  va_copy(args2, args);
+  auto length = vsnprintf(mData + prefix.size(), sizeof(mStackBuffer) - prefix.size(), format, args);
+
+  if (length >= 0 && prefix.size() + static_cast<std::size_t>(length) + 1 >= sizeof(mStackBuffer))
+  {
+    mHeapBuffer.reset(new (std::nothrow) char[prefix.size() + static_cast<std::size_t>(length) + 2]);
+    if (mHeapBuffer)
+    {
+      mData = mHeapBuffer.get();
+      memcpy(mData, prefix.data(), prefix.size());
+      vsnprintf(mData + prefix.size(), static_cast<std::size_t>(length) + 1, format, args2);
+    }
+    else
+      length = static_cast<int>(sizeof(mStackBuffer) - prefix.size() - 2);
+  }
+
+  va_end(args2);
+  if (length < 0)
+    return;
+
+  mSize = prefix.size() + static_cast<std::size_t>(length);
+  mData[mSize++] = '\n';
+}
+
+
+
+/// Builds a journal record in the log_writer's ring buffer.
+class journal_record
+{
+  public:
+    /// Adds the field with given \a name and \a value, or only computes the
+    /// record size if the record was not reserved yet.
+    void add(std::string_view name, std::string_view value) noexcept;
+
+    /// Reserves the record, after all fields were added once.
+    bool reserve(log_writer& writer) noexcept;
+
+    std::size_t size() const noexcept
+    { return mSize; }
+
+  private:
+    char* mData{nullptr};
+    std::size_t mSize{0};
+};
+
+
+
+void journal_record::add(std::string_view name, std::string_view value) noexcept
+{
+  auto length = static_cast<std::uint32_t>(name.size() + 1 + value.size());
+  if (mData)
+  {
+    memcpy(mData, &length, sizeof(length));
+    memcpy(mData + sizeof(length), name.data(), name.size());
+    mData[sizeof(length) + name.size()] = '=';
+    memcpy(mData + sizeof(length) + name.size() + 1, value.data(), value.size());
+    mData += sizeof(length) + padded(length, 4);
+  }
+  else
+    mSize += sizeof(length) + padded(length, 4);
+}
+
+
+
+bool journal_record::reserve(log_writer& writer) noexcept
+{
+  mData = writer.reserve(record_kind::journal, mSize);
+  return mData;
+}
+
+
+
+static void add_journal_fields(journal_record& record, std::string_view message, std::string_view priority, std::string_view duration) noexcept
+{
+  record.add("MESSAGE", message);
+  record.add("PRIORITY", priority);
+  record.add("SYSLOG_IDENTIFIER", program_invocation_short_name);
+
+  if (auto fields = log_current_fields)
+  {
+    if (!fields->hookName.empty())    record.add("HOOK_NAME", fields->hookName);
+    if (!fields->projectPath.empty()) record.add("PROJECT_PATH", fields->projectPath);
+    if (!fields->pipelineId.empty())  record.add("PIPELINE_ID", fields->pipelineId);
+    if (!fields->eventId.empty())     record.add("EVENT_ID", fields->eventId);
+    if (!fields->peer.empty())        record.add("PEER", fields->peer);
+    if (!duration.empty())            record.add("DURATION_USEC", duration);
+  }
+}
+
+
+
+static void send_journal_message(log_writer& writer, char priority, std::string_view message) noexcept
+{
+  char duration[24];
+  std::string_view durationText;
+
+  if (log_current_fields && log_current_fields->duration.count() >= 0)
+  {
+    auto length  = snprintf(duration, sizeof(duration), "%lld", static_cast<long long>(log_current_fields->duration.count()));
+    durationText = std::string_view{duration, static_cast<std::size_t>(length)};
+  }
+
+  message.remove_suffix(1);  // trailing newline
+  journal_record record;
+  add_journal_fields(record, message, std::string_view{&priority, 1}, durationText);
+  if (!record.reserve(writer))
+    return;
+
+  add_journal_fields(record, message, std::string_view{&priority, 1}, durationText);
+  writer.commit();
+}
+
 
 
 static void write_log_message(log_severity severity, const char* format, va_list args) noexcept
@@ -41,20 +479,39 @@ static void write_log_message(log_severity severity, const char* format, va_list
   if (severity > log_level)
     return;
 
-  char buffer[1024];
-  vsnprintf(buffer, sizeof(buffer), format, args);
-
-  const char* format2 = "%s\n";
+  const char* prefix = "";
+  char priority      = '6';
   switch (severity)
   {
-    case log_severity::fatal:   format2 = log_systemd ? SD_CRIT"fatal error: %s\n" : "fatal error: %s\n"; break;
-    case log_severity::error:   format2 = log_systemd ? SD_ERR"error: %s\n" : "error: %s\n"; break;
-    case log_severity::warning: format2 = log_systemd ? SD_WARNING"warning: %s\n" : "warning: %s\n"; break;
-    case log_severity::info:    format2 = log_systemd ? SD_NOTICE"%s\n" : "%s\n"; break;
-    case log_severity::debug:   format2 = log_systemd ? SD_DEBUG"%s\n" : "%s\n"; break;
+    case log_severity::fatal:   prefix = log_systemd ? SD_CRIT"fatal error: " : "fatal error: "; priority = '2'; break;
+    case log_severity::error:   prefix = log_systemd ? SD_ERR"error: " : "error: "; priority = '3'; break;
+    case log_severity::warning: prefix = log_systemd ? SD_WARNING"warning: " : "warning: "; priority = '4'; break;
+    case log_severity::info:    prefix = log_systemd ? SD_NOTICE : ""; priority = '5'; break;
+    case log_severity::debug:   prefix = log_systemd ? SD_DEBUG : ""; priority = '7'; break;
+  }
+
+  auto& writer = log_writer::instance();
+  if (log_journal)
+  {
+    formatted_message message{"", format, args};
+    if (!message.text().empty())
+      send_journal_message(writer, priority, message.text());
+  }
+  else
+  {
+    formatted_message message{prefix, format, args};
+    auto text = message.text();
+
+    if (!text.empty())
+      if (auto data = writer.reserve(record_kind::text, text.size()))
+      {
+        memcpy(data, text.data(), text.size());
+        writer.commit();
+      }
   }
 
-  fprintf(stderr, format2, buffer);
+  if (severity == log_severity::fatal)
+    writer.flush();
 }
 
 
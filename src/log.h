@@ -16,6 +16,8 @@
     with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <chrono>
+#include <string_view>
 
 
 
@@ -30,6 +32,40 @@ void set_log_level(log_severity severity) noexcept;
 /// Sets system-d style logging \a enabled.
 void set_log_systemd(bool enabled) noexcept;
 
+/// Sends log messages with structured fields to the systemd journal if \a
+/// enabled, instead of writing them to stderr.
+void set_log_journal(bool enabled) noexcept;
+
+
+
+/// Fields of a webhook event that are attached to log messages sent to the
+/// systemd journal. Empty fields are omitted.
+struct log_fields
+{
+  std::string_view hookName;
+  std::string_view projectPath;
+  std::string_view pipelineId;
+  std::string_view eventId;
+  std::string_view peer;
+  std::chrono::microseconds duration{-1};
+};
+
+
+/// Attaches log_fields to all log messages while the scope exists.
+class log_scope
+{
+  public:
+    /// Attaches the \a fields, which must outlive the scope.
+    explicit log_scope(const log_fields& fields) noexcept;
+    ~log_scope();
+
+  private:
+    log_scope(const log_scope&) = delete;
+    log_scope& operator=(const log_scope&) = delete;
+
+    const log_fields* mPrevious;
+};
+
 
 
 /// Logs a fatal error message composed from a printf-like \a format string and
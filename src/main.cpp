@@ -16,22 +16,37 @@
     with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
 */
 #include "action_list.h"
+#include "capture.h"
+#include "completion_store.h"
 #include "config.h"
+#include "event_cache.h"
+#include "graceful_shutdown.h"
+#include "handover.h"
 #include "hook.h"
 #include "http_server.h"
 #include "io_context.h"
 #include "log.h"
+#include "metrics.h"
+#include "replay.h"
 #include "signal_listener.h"
+#include "snapshot.h"
+#include "stats_segment.h"
+#include "trace.h"
 #include "watchdog.h"
 #include <boost/program_options.hpp>
 #include <csignal>
 #include <cstdlib>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <nlohmann/json.hpp>
+#include <optional>
 #include <sstream>
+#include <system_error>
 #include <systemd/sd-daemon.h>
+#include <unistd.h>
 #include <vector>
 using namespace std::chrono_literals;
 
@@ -43,6 +58,10 @@ struct command_line
 
   std::string configFile;
   log_severity logLevel;
+  int handoverFd{-1};
+  std::vector<std::string> replayFiles;
+  double replaySpeed{0};
+  std::vector<std::string> args;
 };
 
 
@@ -59,18 +78,34 @@ command_line::command_line(int argc, char** argv)
       ("version", "Show version information.")
       ("config", value<std::string>(&configFile)->default_value(DEFAULT_CONFIG_FILE), "Sets the configuration file to use.")
       ("systemd", "Enables systemd log message format.")
-      ("verbose", value<int>(&verbosity)->implicit_value(0), "Increases the amount of log messages.");
+      ("journal", "Sends structured log messages to the systemd journal.")
+      ("verbose", value<int>(&verbosity)->implicit_value(0), "Increases the amount of log messages.")
+      ("replay", value<std::vector<std::string>>(&replayFiles), "Replays the requests from a capture file through the configured hooks without executing commands, then exits. Can be given multiple times.")
+      ("replay-speed", value<double>(&replaySpeed)->default_value(0), "Paces the replay at this multiple of the recorded rate, e.g. 1 for real time; 0 replays as fast as possible.");
+
+  options_description hidden;
+  hidden.add_options()
+      ("handover-fd", value<int>(&handoverFd), "Socket for receiving state from the previous instance.");
+
+  options_description all;
+  all.add(options).add(hidden);
 
   variables_map vm;
-  store(parse_command_line(argc, argv, options), vm);
+  store(parse_command_line(argc, argv, all), vm);
   notify(vm);
 
+  for (int i = 0; i < argc; ++i)
+    if (std::string_view{argv[i]}.substr(0, 13) != "--handover-fd")
+      args.emplace_back(argv[i]);
+
   if (vm.count("help"))
   {
     std::cout << EXECUTABLE" [OPTION]...\n\n"
               << "Runs an HTTP(S) server that listens for Gitlab webhook events and processes\n"
               << "them. If the event matches the configured criteria, gitlab-hook executes the\n"
               << "configured action. Typically, it executes a custom script.\n\n"
+              << "Signal SIGUSR1 reloads the configuration. Signal SIGWINCH starts the program\n"
+              << "binary anew and hands over the listening socket and pending actions to it.\n\n"
               << options;
     std::exit(0);
   }
@@ -84,6 +119,9 @@ command_line::command_line(int argc, char** argv)
   if (vm.count("systemd"))
     set_log_systemd(true);
 
+  if (vm.count("journal"))
+    set_log_journal(true);
+
   if (verbosity < 0)
     logLevel = log_severity::warning;
   else if (verbosity == 0)
@@ -156,25 +194,76 @@ class http_server : public http::server
 class StatusPage
 {
   public:
+    explicit StatusPage(const watchdog& watchdog) noexcept
+      : mWatchdog{watchdog}
+    {}
+
     void operator()(http::request request) const;
 
   private:
+    void respondJson(http::request request) const;
+
+    const watchdog& mWatchdog;
     const time_t mStart{std::time(nullptr)};
 };
 
 
 
+static double milliseconds(watchdog::duration value) noexcept
+{ return std::chrono::duration<double,std::milli>{value}.count(); }
+
+
+
+struct html_escaped
+{
+  std::string_view text;
+};
+
+
+
+static std::ostream& operator<<(std::ostream& out, html_escaped str)
+{
+  for (char c: str.text)
+    switch (c)
+    {
+      case '&': out << "&amp;"; break;
+      case '<': out << "&lt;"; break;
+      case '>': out << "&gt;"; break;
+      case '"': out << "&quot;"; break;
+      default:  out << c; break;
+    }
+
+  return out;
+}
+
+
+
 void StatusPage::operator()(http::request request) const
 {
   if (request.method() != http::method::get)
     return request.respond(http::code::method_not_allowed, "method not allowed");
 
+  if (request.query("format") == "json")
+    return respondJson(request);
+
   struct tm startTm;
   localtime_r(&mStart, &startTm);
 
-  auto lastFailure = action_list::lastFailure();
+  hook_stats total;
+  for (const auto& stats: metrics::hooks())
+  {
+    total.rejected   += stats.rejected;
+    total.received   += stats.received;
+    total.scheduled  += stats.scheduled;
+    total.executed   += stats.executed;
+    total.failed     += stats.failed;
+    total.lastFailure = std::max(total.lastFailure, stats.lastFailure);
+  }
+
   struct tm lastFailureTm;
-  localtime_r(&lastFailure, &lastFailureTm);
+  localtime_r(&total.lastFailure, &lastFailureTm);
+
+  const auto lag = mWatchdog.lag();
 
   std::ostringstream body;
   body << R"(<!doctype html>
@@ -191,14 +280,33 @@ void StatusPage::operator()(http::request request) const
    <h1 class="mt-5">Gitlab-Hook Status</h1>
    <dl class="mt-4 row" id="infos">
     <dt class="col-sm-3">Up since:</dt><dd class="col-sm-9">)" << std::put_time(&startTm, "%Y-%m-%d %X") << R"(</dd>
-    <dt class="col-sm-3">Good requests:</dt><dd class="col-sm-9">)" << hook::goodRequestCount() << R"(</dd>
-    <dt class="col-sm-3">Rejected requests:</dt><dd class="col-sm-9">)" << hook::requestCount() - hook::goodRequestCount() << R"(</dd>
-    <dt class="col-sm-3">Hooks scheduled:</dt><dd class="col-sm-9">)" << hook::scheduledCount() << R"(</dd>
-    <dt class="col-sm-3">Hooks executed:</dt><dd class="col-sm-9">)" << action_list::executedCount() << R"(</dd>
-    <dt class="col-sm-3">Hooks failed:</dt><dd class="col-sm-9">)" << action_list::failedCount() << R"(</dd>
+    <dt class="col-sm-3">Good requests:</dt><dd class="col-sm-9">)" << total.received << R"(</dd>
+    <dt class="col-sm-3">Rejected requests:</dt><dd class="col-sm-9">)" << total.rejected << R"(</dd>
+    <dt class="col-sm-3">Hooks scheduled:</dt><dd class="col-sm-9">)" << total.scheduled << R"(</dd>
+    <dt class="col-sm-3">Hooks executed:</dt><dd class="col-sm-9">)" << total.executed << R"(</dd>
+    <dt class="col-sm-3">Hooks failed:</dt><dd class="col-sm-9">)" << total.failed << R"(</dd>
     <dt class="col-sm-3">Last failure:</dt><dd class="col-sm-9">)";
-      if (lastFailure) body << std::put_time(&lastFailureTm, "%Y-%m-%d %X"); body << R"(</dd>
+      if (total.lastFailure) body << std::put_time(&lastFailureTm, "%Y-%m-%d %X");
+      body << std::fixed << std::setprecision(1) << R"(</dd>
+    <dt class="col-sm-3">Event loop lag:</dt><dd class="col-sm-9">)" << milliseconds(lag.p50) << " ms median, "
+         << milliseconds(lag.p90) << " ms p90, " << milliseconds(lag.p99) << " ms p99, " << milliseconds(lag.max)
+         << " ms max in the last minute; " << milliseconds(lag.longest) << " ms longest";
+      if (!lag.longestCause.empty()) body << " after " << html_escaped{lag.longestCause};
+      body << R"(</dd>
    </dl>
+   <table class="table table-sm mt-4" id="hooks">
+    <thead>
+     <tr><th>Hook</th><th>Requests</th><th>Accepted</th><th>Ignored</th><th>Scheduled</th><th>Succeeded</th><th>Failed</th><th>Timed out</th><th>Last duration</th><th>Avg. duration</th><th>Avg. wait</th></tr>
+    </thead>
+    <tbody>
+)";
+  for (const auto& stats: metrics::hooks())
+    body << "     <tr><td>" << html_escaped{stats.name} << "</td><td>" << stats.requests << "</td><td>" << stats.accepted
+         << "</td><td>" << stats.ignored << "</td><td>" << stats.scheduled << "</td><td>" << stats.succeeded
+         << "</td><td>" << stats.failed << "</td><td>" << stats.timedOut << "</td><td>" << stats.lastDuration
+         << " s</td><td>" << stats.avgDuration << " s</td><td>" << stats.avgWait << " s</td></tr>\n";
+  body << R"(    </tbody>
+   </table>
   </div>
  </main>
  <footer class="footer mt-auto py-3">
@@ -218,43 +326,315 @@ void StatusPage::operator()(http::request request) const
 
 
 
+void StatusPage::respondJson(http::request request) const
+{
+  auto hooks = nlohmann::json::array();
+  for (const auto& stats: metrics::hooks())
+    hooks.push_back({
+      {"name",         stats.name},
+      {"rejected",     stats.rejected},
+      {"received",     stats.received},
+      {"requests",     stats.requests},
+      {"accepted",     stats.accepted},
+      {"ignored",      stats.ignored},
+      {"scheduled",    stats.scheduled},
+      {"executed",     stats.executed},
+      {"succeeded",    stats.succeeded},
+      {"failed",       stats.failed},
+      {"timed_out",    stats.timedOut},
+      {"last_failure", stats.lastFailure},
+      {"last_duration", stats.lastDuration},
+      {"avg_duration", stats.avgDuration},
+      {"avg_wait",     stats.avgWait}});
+
+  const auto lag = mWatchdog.lag();
+  nlohmann::json body{
+    {"version",       VERSION},
+    {"up_since",      mStart},
+    {"queue_depth",   action_list::size() - action_list::running()},
+    {"running",       action_list::running()},
+    {"loop_lag_ms",   {
+      {"p50",         milliseconds(lag.p50)},
+      {"p90",         milliseconds(lag.p90)},
+      {"p99",         milliseconds(lag.p99)},
+      {"max",         milliseconds(lag.max)},
+      {"longest",     milliseconds(lag.longest)},
+      {"longest_cause", lag.longestCause}}},
+    {"hooks",         std::move(hooks)}};
+
+  request.respond(http::code::ok, body.dump());
+}
+
+
+
 int main(int argc, char** argv)
 try {
   const command_line cmdline{argc, argv};
   set_log_level(cmdline.logLevel);
   log_info("using configuration file %s", cmdline.configFile.c_str());
 
+  if (!cmdline.replayFiles.empty())
+  {
+    replay replay{config::file::load(cmdline.configFile)};
+    for (auto& file: cmdline.replayFiles)
+      replay.run(file, cmdline.replaySpeed);
+
+    replay.report(std::cout);
+    return 0;
+  }
+
+  std::optional<handover> predecessor;
+  if (cmdline.handoverFd != -1)
+    predecessor.emplace(handover::receive(cmdline.handoverFd));
+
   io_context io;
   for (;;)
   {
     const auto configuration = config::file::load(cmdline.configFile);
-    watchdog watchdog{io};
-    action_list actions{io};
+    metrics::reset_hooks();
 
-    signal_listener sigs1{io};
-    sigs1.add(SIGHUP, SIGINT, SIGTERM);
-    sigs1.wait([&io](int sig)
+    if (configuration.contains("profiler") && configuration["profiler"].to_bool())
     {
-      log_warning("signal %i raised, quit application", sig);
-      io.stop();
-    });
+      auto budget = 50ms;
+      if (configuration.contains("profiler_budget"))
+        budget = std::chrono::milliseconds{configuration["profiler_budget"].to<std::chrono::milliseconds::rep>()};
+
+      io_context::enable_profiler(budget);
+    }
+    else
+      io_context::disable_profiler();
+
+    auto watchdogMaxLag = 1000ms;
+    if (configuration.contains("watchdog_max_lag"))
+      watchdogMaxLag = std::chrono::milliseconds{configuration["watchdog_max_lag"].to<std::chrono::milliseconds::rep>()};
+
+    auto spawn = process::spawn_strategy::fork;
+    if (configuration.contains("spawn"))
+    {
+      auto name = configuration["spawn"].to_string();
+      if (name == "vfork")
+        spawn = process::spawn_strategy::vfork;
+      else if (name != "fork")
+        throw std::runtime_error{"invalid spawn strategy " + name};
+    }
+
+    process::set_spawn_strategy(spawn);
 
-    bool restart = false;
+    watchdog watchdog{io, watchdogMaxLag};
+    action_list actions{io};
+
+    graceful_shutdown shutdown{io};
+    bool restart  = false;
+    bool upgraded = false;
     signal_listener sigs2{io};
     sigs2.add(SIGUSR1);
-    sigs2.wait([&io, &restart](int sig)
+    sigs2.wait([&io, &restart, &upgraded, &shutdown](int sig)
     {
+      if (upgraded)
+        return log_warning("signal %i raised, but upgrading to new instance", sig);
+
+      // A new server would accept requests again.
+      if (shutdown.is_running())
+        return log_warning("signal %i raised, but shutting down", sig);
+
       log_warning("signal %i raised, reload application", sig);
+      hook::flush_batches();
       restart = true;
       io.stop();
     });
 
+    signal_listener sigs4{io};
+    sigs4.add(SIGUSR2);
+    sigs4.wait([](int)
+    { io_context::dump_profile(); });
+
     http_server httpd{configuration["httpd"], io};
+    if (predecessor)
+      httpd.set_listen_socket(predecessor->listen_socket());
+
     httpd.start();
 
-    StatusPage statusPage;
+    auto shutdownTimeout = 30s;
+    if (configuration.contains("shutdown_timeout"))
+      shutdownTimeout = std::chrono::seconds{configuration["shutdown_timeout"].to<std::chrono::seconds::rep>()};
+
+    bool shutdownWaitPending = false;
+    if (configuration.contains("shutdown_wait_pending"))
+      shutdownWaitPending = configuration["shutdown_wait_pending"].to_bool();
+
+    signal_listener sigs1{io};
+    sigs1.add(SIGHUP, SIGINT, SIGTERM);
+    sigs1.wait([&](int sig)
+    {
+      if (shutdown.is_running() || shutdownTimeout == 0s)
+      {
+        log_warning("signal %i raised, quit application", sig);
+        return io.stop();
+      }
+
+      log_warning("signal %i raised, quit application after running hooks", sig);
+      httpd.quiesce();
+      httpd.reject_requests();
+      hook::flush_batches();
+      shutdown.start(shutdownTimeout, shutdownWaitPending);
+    });
+
+    // Serves requests on the listening socket again after a failed upgrade.
+    auto resumeServing = [&io, &httpd](int listenFd)
+    {
+      try {
+        httpd.stop();
+        httpd.set_listen_socket(listenFd);
+        httpd.reject_requests(false);
+        httpd.start();
+      }
+      catch (const std::exception& e)
+      {
+        log_error("failed to restart HTTP server: %s", e.what());
+        io.stop();
+      }
+    };
+
+    std::optional<handover::successor> successor;
+    signal_listener sigs3{io};
+    sigs3.add(SIGWINCH);
+    sigs3.wait([&io, &httpd, &upgraded, &shutdown, &cmdline, &successor, &resumeServing](int sig)
+    {
+      if (upgraded || shutdown.is_running())
+        return;
+
+      // The new instance must not execute a hook while this one still does.
+      log_warning("signal %i raised, upgrade application after running hook", sig);
+      upgraded = true;
+      action_list::pause([&io, &httpd, &upgraded, &shutdown, &cmdline, &successor, &resumeServing]
+      {
+        if (shutdown.is_running())
+        {
+          log_warning("upgrade cancelled by shutdown");
+          upgraded = false;
+          return action_list::resume();
+        }
+
+        int listenFd = -1;
+        try {
+          hook::flush_batches();
+          snapshot_writer pending;
+          action_list::save_pending(pending);
+
+          listenFd = fcntl(httpd.listen_socket(), F_DUPFD_CLOEXEC, 0);
+          if (listenFd == -1)
+            throw std::system_error{errno, std::system_category(), "failed to duplicate listening socket"};
+
+          successor.emplace(io, cmdline.args, listenFd, pending.data(),
+            [&io, &upgraded, &shutdown, &successor, &resumeServing, listenFd](bool tookOver)
+            {
+              if (!tookOver)
+              {
+                log_error("upgrade failed");
+                successor.reset();
+                upgraded = false;
+                if (shutdown.is_running())
+                  close(listenFd);
+                else
+                  resumeServing(listenFd);
+
+                return action_list::resume();
+              }
+
+              auto pid = successor->pid();
+              close(listenFd);
+              action_list::remove_pending();
+              action_list::resume();
+
+              log_warning("handed over to new instance %i", static_cast<int>(pid));
+              sd_notifyf(0, "MAINPID=%i\nSTATUS=Handed over to new instance\n", static_cast<int>(pid));
+              action_list::when_idle([&io]{ io.stop(); });
+            });
+
+          // Until the new instance takes over, new connections wait for it, and
+          // requests on open ones are rejected, since they are not handed over.
+          httpd.quiesce();
+          httpd.reject_requests();
+          log_info("waiting for new instance %i to take over", static_cast<int>(successor->pid()));
+        }
+        catch (const std::exception& e)
+        {
+          log_error("upgrade failed: %s", e.what());
+          upgraded = false;
+          if (listenFd != -1)
+            close(listenFd);
+
+          action_list::resume();
+        }
+      });
+    });
+
+    StatusPage statusPage{watchdog};
     httpd.add_handler("/status", std::ref(statusPage));
 
+    metrics metricsPage;
+    httpd.add_handler("/metrics", std::ref(metricsPage));
+
+    std::optional<stats_segment> statsSegment;
+    if (configuration.contains("stats_file"))
+      statsSegment.emplace(io, configuration["stats_file"].to_string());
+
+    std::optional<trace_log> traceLog;
+    if (configuration.contains("trace_file"))
+      traceLog.emplace(io, configuration["trace_file"].to_string());
+
+    std::optional<capture_file> captureFile;
+    if (configuration.contains("capture"))
+    {
+      auto cfg = configuration["capture"];
+      std::size_t maxSizeMiB = 64;
+      if (cfg.contains("max_size"))
+        maxSizeMiB = static_cast<std::size_t>(cfg["max_size"].to_int_range(1, 1024 * 1024));
+
+      unsigned maxFiles = 4;
+      if (cfg.contains("max_files"))
+        maxFiles = static_cast<unsigned>(cfg["max_files"].to_int_range(1, 1000));
+
+      bool redactTokens = true;
+      if (cfg.contains("redact_tokens"))
+        redactTokens = cfg["redact_tokens"].to_bool();
+
+      captureFile.emplace(cfg["file"].to_string(), maxSizeMiB * 1024 * 1024, maxFiles, redactTokens);
+    }
+
+    std::optional<event_cache> eventCache;
+    if (configuration.contains("deduplication"))
+    {
+      auto cfg = configuration["deduplication"];
+      std::size_t capacity = 4096;
+      if (cfg.contains("capacity"))
+        capacity = static_cast<std::size_t>(cfg["capacity"].to_int_range(8, 16 * 1024 * 1024));
+
+      auto expiry = 3600s;
+      if (cfg.contains("expiry"))
+        expiry = std::chrono::seconds{cfg["expiry"].to_int_range(1, 30 * 24 * 3600)};
+
+      std::string fileName;
+      if (cfg.contains("file"))
+        fileName = cfg["file"].to_string();
+
+      eventCache.emplace(capacity, expiry, fileName);
+    }
+
+    std::size_t completionsCapacity = 1024;
+    std::string completionsFile;
+    if (configuration.contains("completions"))
+    {
+      auto cfg = configuration["completions"];
+      if (cfg.contains("capacity"))
+        completionsCapacity = static_cast<std::size_t>(cfg["capacity"].to_int_range(1, 1024 * 1024));
+
+      if (cfg.contains("file"))
+        completionsFile = cfg["file"].to_string();
+    }
+
+    completion_store completions{io, completionsCapacity, completionsFile};
+
     auto hooksCfg = configuration["hooks"];
     std::vector<std::unique_ptr<hook>> hooks;
     hooks.reserve(hooksCfg.size());
@@ -275,6 +655,15 @@ try {
         (*same)->chain(std::move(nhook));
     }
 
+    if (predecessor)
+    {
+      snapshot_reader pending{predecessor->actions()};
+      action_list::restore(pending);
+      predecessor->acknowledge();
+      predecessor.reset();
+    }
+
+    stats_segment::touch();
     log_info("started gitlab-hook");
     sd_notify(0, "READY=1\nSTATUS=Normal operation\n");
     io.run();
@@ -0,0 +1,285 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "action_list.h"
+#include "metrics.h"
+#include "stats_segment.h"
+#include <algorithm>
+#include <charconv>
+#include <vector>
+
+
+
+histogram metrics::requestTime;
+histogram metrics::queueWaitTime;
+histogram metrics::actionRunTime;
+
+// Weight of a new value in the moving averages.
+constexpr double ewmaWeight = 0.2;
+
+// Statistics of the hooks of the current configuration indexed by hook ID,
+// and of the previous configuration.
+static std::vector<hook_stats> hooksStats;
+static std::vector<hook_stats> previousHooksStats;
+
+// Number of HTTP responses by status code, indexed by code - 100.
+static std::array<std::uint64_t,500> responseCounts{};
+
+
+
+void histogram::observe(duration value) noexcept
+{
+  auto seconds = std::chrono::duration<double>{value}.count();
+  auto bucket  = std::lower_bound(bounds.begin(), bounds.end(), seconds) - bounds.begin();
+
+  ++mBuckets[static_cast<std::size_t>(bucket)];
+  ++mCount;
+  mSum += seconds;
+}
+
+
+
+inline void update_average(double& average, double value, std::uint64_t count) noexcept
+{ average = count <= 1 ? value : average + ewmaWeight * (value - average); }
+
+
+
+void hook_stats::action_started(histogram::duration wait) noexcept
+{
+  ++executed;
+  update_average(avgWait, std::chrono::duration<double>{wait}.count(), executed);
+  stats_segment::touch();
+}
+
+
+
+void hook_stats::action_finished(histogram::duration duration, bool success) noexcept
+{
+  if (success)
+    ++succeeded;
+  else
+  {
+    ++failed;
+    lastFailure = std::time(nullptr);
+  }
+
+  lastDuration = std::chrono::duration<double>{duration}.count();
+  update_average(avgDuration, lastDuration, succeeded + failed);
+  stats_segment::touch();
+}
+
+
+
+void metrics::reset_hooks() noexcept
+{
+  previousHooksStats.swap(hooksStats);
+  hooksStats.clear();
+}
+
+
+
+std::size_t metrics::hook_id(std::string_view name)
+{
+  for (std::size_t id = 0; id != hooksStats.size(); ++id)
+    if (hooksStats[id].name == name)
+      return id;
+
+  auto previous = std::find_if(previousHooksStats.begin(), previousHooksStats.end(), [name](const hook_stats& stats)
+  { return stats.name == name; });
+
+  if (previous != previousHooksStats.end())
+    hooksStats.push_back(std::move(*previous));
+  else
+    hooksStats.emplace_back().name = name;
+
+  return hooksStats.size() - 1;
+}
+
+
+
+hook_stats& metrics::hook(std::size_t id) noexcept
+{ return hooksStats[id]; }
+
+
+std::span<const hook_stats> metrics::hooks() noexcept
+{ return hooksStats; }
+
+
+
+void metrics::count_response(http::code code) noexcept
+{
+  auto index = static_cast<std::size_t>(code) - 100;
+  if (index < responseCounts.size())
+    ++responseCounts[index];
+
+  stats_segment::touch();
+}
+
+
+
+std::uint64_t metrics::response_count(http::code code) noexcept
+{
+  auto index = static_cast<std::size_t>(code) - 100;
+  return index < responseCounts.size() ? responseCounts[index] : 0;
+}
+
+
+
+static void append(std::string& out, std::uint64_t value)
+{
+  char buffer[24];
+  auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+  out.append(buffer, end);
+}
+
+
+
+static void append(std::string& out, double value)
+{
+  char buffer[32];
+  auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+  out.append(buffer, end);
+}
+
+
+
+static void append_label_value(std::string& out, std::string_view value)
+{
+  for (char c: value)
+    switch (c)
+    {
+      case '\\': out.append("\\\\"); break;
+      case '"':  out.append("\\\""); break;
+      case '\n': out.append("\\n"); break;
+      default:   out.push_back(c); break;
+    }
+}
+
+
+
+static void append_header(std::string& out, const char* name, const char* type, const char* help)
+{
+  out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+
+
+static void append_gauge(std::string& out, const char* name, const char* help, std::uint64_t value)
+{
+  append_header(out, name, "gauge", help);
+  out.append(name).append(" ");
+  append(out, value);
+  out.append("\n");
+}
+
+
+
+static void append_responses(std::string& out)
+{
+  append_header(out, "gitlab_hook_http_responses_total", "counter", "HTTP responses by status code.");
+
+  for (std::size_t i = 0; i != responseCounts.size(); ++i)
+    if (responseCounts[i])
+    {
+      out.append("gitlab_hook_http_responses_total{code=\"");
+      append(out, static_cast<std::uint64_t>(i + 100));
+      out.append("\"} ");
+      append(out, responseCounts[i]);
+      out.append("\n");
+    }
+}
+
+
+
+template<typename T>
+static void append_hooks(std::string& out, const char* name, const char* type, const char* help, T hook_stats::* value)
+{
+  append_header(out, name, type, help);
+
+  for (const auto& entry: hooksStats)
+  {
+    out.append(name).append("{hook=\"");
+    append_label_value(out, entry.name);
+    out.append("\"} ");
+    append(out, entry.*value);
+    out.append("\n");
+  }
+}
+
+
+
+static void append_histogram(std::string& out, const char* name, const char* help, const histogram& hist)
+{
+  append_header(out, name, "histogram", help);
+
+  std::uint64_t cumulative = 0;
+  for (std::size_t i = 0; i != histogram::bounds.size(); ++i)
+  {
+    cumulative += hist.bucket(i);
+    out.append(name).append("_bucket{le=\"");
+    append(out, histogram::bounds[i]);
+    out.append("\"} ");
+    append(out, cumulative);
+    out.append("\n");
+  }
+
+  out.append(name).append("_bucket{le=\"+Inf\"} ");
+  append(out, hist.count());
+  out.append("\n").append(name).append("_sum ");
+  append(out, hist.sum());
+  out.append("\n").append(name).append("_count ");
+  append(out, hist.count());
+  out.append("\n");
+}
+
+
+
+void metrics::operator()(http::request request) const
+{
+  if (request.method() != http::method::get)
+    return request.respond(http::code::method_not_allowed, "method not allowed");
+
+  // Renders one metric family per invocation, so that a scrape is spread
+  // over several event loop iterations.
+  request.respond(http::code::ok, "text/plain; version=0.0.4", [step = 0](std::string& out) mutable
+  {
+    switch (step++)
+    {
+      case 0:
+        append_gauge(out, "gitlab_hook_queue_depth", "Actions waiting for execution.", action_list::size() - action_list::running());
+        append_gauge(out, "gitlab_hook_running_actions", "Actions currently executing.", action_list::running());
+        break;
+
+      case 1: append_responses(out); break;
+      case 2:  append_hooks(out, "gitlab_hook_rejected_total", "counter", "Unauthorized requests to the URI-Path of a hook.", &hook_stats::rejected); break;
+      case 3:  append_hooks(out, "gitlab_hook_requests_total", "counter", "Authorized requests processed by a hook.", &hook_stats::requests); break;
+      case 4:  append_hooks(out, "gitlab_hook_accepted_total", "counter", "Requests that matched the criteria of a hook.", &hook_stats::accepted); break;
+      case 5:  append_hooks(out, "gitlab_hook_ignored_total", "counter", "Requests that did not match the criteria of a hook.", &hook_stats::ignored); break;
+      case 6:  append_hooks(out, "gitlab_hook_scheduled_total", "counter", "Actions scheduled by a hook.", &hook_stats::scheduled); break;
+      case 7:  append_hooks(out, "gitlab_hook_succeeded_total", "counter", "Actions of a hook that succeeded.", &hook_stats::succeeded); break;
+      case 8:  append_hooks(out, "gitlab_hook_failed_total", "counter", "Actions of a hook that failed.", &hook_stats::failed); break;
+      case 9:  append_hooks(out, "gitlab_hook_timed_out_total", "counter", "Actions of a hook that timed out.", &hook_stats::timedOut); break;
+      case 10: append_hooks(out, "gitlab_hook_last_duration_seconds", "gauge", "Run time of the last action of a hook.", &hook_stats::lastDuration); break;
+      case 11: append_histogram(out, "gitlab_hook_request_duration_seconds", "Time from receiving an HTTP request until responding.", requestTime); break;
+      case 12: append_histogram(out, "gitlab_hook_queue_wait_seconds", "Time an action waits for execution.", queueWaitTime); break;
+      case 13: append_histogram(out, "gitlab_hook_action_duration_seconds", "Time an action takes to execute.", actionRunTime); break;
+    }
+
+    return step <= 13;
+  });
+}
@@ -0,0 +1,132 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "http_server.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <span>
+#include <string>
+#include <string_view>
+
+
+
+/// A histogram of durations with fixed bucket boundaries. Observing a value
+/// does not allocate memory.
+class histogram
+{
+  public:
+    using duration = std::chrono::steady_clock::duration;
+
+    /// Upper bounds of the buckets in seconds, excluding the final +Inf bucket.
+    static constexpr std::array<double,18> bounds{
+      0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5,
+      1, 2.5, 5, 10, 30, 60, 120, 300, 600};
+
+    /// Adds the \a value to the histogram.
+    void observe(duration value) noexcept;
+
+    /// The number of values in bucket \a index, not cumulative. The last
+    /// bucket at index bounds.size() is the +Inf bucket.
+    std::uint64_t bucket(std::size_t index) const noexcept
+    { return mBuckets[index]; }
+
+    /// The number of values observed.
+    std::uint64_t count() const noexcept
+    { return mCount; }
+
+    /// The sum of all values observed, in seconds.
+    double sum() const noexcept
+    { return mSum; }
+
+  private:
+    std::array<std::uint64_t,bounds.size() + 1> mBuckets{};
+    std::uint64_t mCount{0};
+    double mSum{0};
+};
+
+
+
+/// Statistics for a single hook, identified by its name.
+struct hook_stats
+{
+  std::string name;
+  std::uint64_t rejected{0};   ///< unauthorized requests to the hook's URI-Path
+  std::uint64_t received{0};   ///< authorized requests to the hook's URI-Path, counted by the first hook of a chain
+  std::uint64_t requests{0};   ///< authorized requests processed by the hook
+  std::uint64_t accepted{0};   ///< requests that matched the hook's criteria
+  std::uint64_t ignored{0};    ///< requests that did not match
+  std::uint64_t scheduled{0};  ///< actions appended to the action list
+  std::uint64_t executed{0};   ///< actions started
+  std::uint64_t succeeded{0};  ///< actions completed successfully
+  std::uint64_t failed{0};     ///< actions that failed, including timeouts
+  std::uint64_t timedOut{0};   ///< actions that were terminated after timeout
+  std::time_t lastFailure{0};  ///< time of the last failed action
+  double lastDuration{0};      ///< run time of the last action in seconds
+  double avgDuration{0};       ///< moving average of the run time in seconds
+  double avgWait{0};           ///< moving average of the queue wait time in seconds
+
+  /// Records the start of an action after it waited for time \a wait.
+  void action_started(histogram::duration wait) noexcept;
+
+  /// Records the completion of an action after run time \a duration.
+  void action_finished(histogram::duration duration, bool success) noexcept;
+};
+
+
+
+/// Application metrics, collected globally since start of the program.
+class metrics
+{
+  public:
+    /// Starts registering the hooks of a new configuration. Hooks registered
+    /// afterwards by hook_id() keep their statistics if their name was
+    /// registered before; the statistics of all other hooks are dropped.
+    static void reset_hooks() noexcept;
+
+    /// The ID of the hook with given \a name, registering it if necessary.
+    /// Hooks with the same name share their statistics.
+    static std::size_t hook_id(std::string_view name);
+
+    /// The statistics of the hook with given \a id. The reference is only
+    /// valid until the next call of hook_id().
+    static hook_stats& hook(std::size_t id) noexcept;
+
+    /// The statistics of all hooks, indexed by ID.
+    static std::span<const hook_stats> hooks() noexcept;
+
+    /// Counts an HTTP response with status \a code.
+    static void count_response(http::code code) noexcept;
+
+    /// The number of HTTP responses with status \a code.
+    static std::uint64_t response_count(http::code code) noexcept;
+
+    /// Time from receiving an HTTP request until its response is queued.
+    static histogram requestTime;
+
+    /// Time an action waits in the action list until it is executed.
+    static histogram queueWaitTime;
+
+    /// Time an action takes to execute.
+    static histogram actionRunTime;
+
+    /// HTTP handler that renders the metrics in Prometheus text exposition
+    /// format.
+    void operator()(http::request request) const;
+};
@@ -0,0 +1,757 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "pattern.h"
+#include <algorithm>
+#include <bitset>
+#include <map>
+#include <stdexcept>
+
+
+
+namespace {
+
+using byte_set = std::bitset<256>;
+
+constexpr std::size_t maxStates    = 4096;
+constexpr std::size_t maxNfaStates = 100000;
+constexpr int maxRepeat            = 1000;
+
+
+
+/// A node of the syntax tree of a pattern.
+struct node
+{
+  enum kind_type { empty, bytes, concat, alternative, repeat, begin_anchor, end_anchor };
+
+  kind_type kind;
+  std::size_t set{0};           ///< bytes: index of the byte set
+  std::vector<std::size_t> children{};
+  int min{0};                   ///< repeat
+  int max{0};                   ///< repeat, -1 for unbounded
+};
+
+
+
+/// The syntax trees of all patterns, sharing the byte sets.
+struct syntax_tree
+{
+  std::vector<node> nodes;
+  std::vector<byte_set> sets;
+
+  std::size_t add(node n)
+  {
+    nodes.push_back(std::move(n));
+    return nodes.size() - 1;
+  }
+
+  std::size_t add_bytes(const byte_set& set)
+  {
+    sets.push_back(set);
+    return add({node::bytes, sets.size() - 1});
+  }
+};
+
+
+
+/// Parses a regular expression into a syntax_tree.
+class regex_parser
+{
+  public:
+    regex_parser(syntax_tree& tree, std::string_view regex) noexcept
+      : mTree{tree},
+        mRegex{regex},
+        mText{regex}
+    {}
+
+    std::size_t parse()
+    {
+      if (mText.starts_with("(?i)"))
+      {
+        mIgnoreCase = true;
+        mText.remove_prefix(4);
+      }
+
+      auto result = alternatives();
+      if (!mText.empty())
+        fail("unbalanced parenthesis");
+
+      return result;
+    }
+
+  private:
+    [[noreturn]] void fail(const char* reason) const
+    { throw std::runtime_error{"invalid regular expression '" + std::string{mRegex} + "': " + reason}; }
+
+    bool next_is(char c) const noexcept
+    { return !mText.empty() && mText.front() == c; }
+
+    char take()
+    {
+      if (mText.empty())
+        fail("unexpected end");
+
+      char c = mText.front();
+      mText.remove_prefix(1);
+      return c;
+    }
+
+    std::size_t alternatives()
+    {
+      node alt{node::alternative};
+      alt.children.push_back(sequence());
+      while (next_is('|'))
+      {
+        take();
+        alt.children.push_back(sequence());
+      }
+
+      return alt.children.size() == 1 ? alt.children.front() : mTree.add(std::move(alt));
+    }
+
+    std::size_t sequence()
+    {
+      node seq{node::concat};
+      while (!mText.empty() && !next_is('|') && !next_is(')'))
+        seq.children.push_back(repetition());
+
+      if (seq.children.empty())
+        return mTree.add({node::empty});
+
+      return seq.children.size() == 1 ? seq.children.front() : mTree.add(std::move(seq));
+    }
+
+    std::size_t repetition()
+    {
+      auto result = atom();
+      for (;;)
+      {
+        node rep{node::repeat};
+        if (next_is('*'))
+          rep.max = -1;
+        else if (next_is('+'))
+          rep.min = 1, rep.max = -1;
+        else if (next_is('?'))
+          rep.max = 1;
+        else if (next_is('{'))
+        {
+          take();
+          rep.min = number();
+          rep.max = rep.min;
+          if (next_is(','))
+          {
+            take();
+            rep.max = next_is('}') ? -1 : number();
+          }
+
+          if (!next_is('}') || (rep.max != -1 && rep.max < rep.min))
+            fail("invalid repetition");
+        }
+        else
+          return result;
+
+        take();
+        if (next_is('?'))
+          take();  // lazy quantifiers match the same texts
+
+        auto& kind = mTree.nodes[result].kind;
+        if (kind == node::begin_anchor || kind == node::end_anchor)
+          fail("repeated anchor");
+
+        rep.children.push_back(result);
+        result = mTree.add(std::move(rep));
+      }
+    }
+
+    int number()
+    {
+      int result = 0;
+      bool any   = false;
+      while (!mText.empty() && mText.front() >= '0' && mText.front() <= '9')
+      {
+        result = result * 10 + (take() - '0');
+        if (result > maxRepeat)
+          fail("repetition count too large");
+
+        any = true;
+      }
+
+      if (!any)
+        fail("invalid repetition");
+
+      return result;
+    }
+
+    std::size_t atom()
+    {
+      char c = take();
+      switch (c)
+      {
+        case '(':
+        {
+          if (next_is('?'))
+          {
+            if (!mText.starts_with("?:"))
+              fail("unsupported group");
+
+            mText.remove_prefix(2);
+          }
+
+          auto result = alternatives();
+          if (take() != ')')
+            fail("unbalanced parenthesis");
+
+          return result;
+        }
+
+        case ')': fail("unbalanced parenthesis");
+        case '*':
+        case '+':
+        case '?':
+        case '{': fail("quantifier without operand");
+        case '^': return mTree.add({node::begin_anchor});
+        case '$': return mTree.add({node::end_anchor});
+        case '[': return mTree.add_bytes(char_class());
+
+        case '.':
+        {
+          byte_set set;
+          set.set();
+          set.reset('\n');
+          return mTree.add_bytes(set);
+        }
+
+        case '\\':
+          return mTree.add_bytes(escape());
+
+        default:
+          return mTree.add_bytes(literal(c));
+      }
+    }
+
+    byte_set literal(char c) const
+    {
+      byte_set set;
+      set.set(static_cast<unsigned char>(c));
+      if (mIgnoreCase && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')))
+        set.set(static_cast<unsigned char>(c ^ 0x20));
+
+      return set;
+    }
+
+    byte_set escape()
+    {
+      byte_set set;
+      char c = take();
+      switch (c)
+      {
+        case 'd': case 'D':
+          for (int i = '0'; i <= '9'; ++i)
+            set.set(static_cast<std::size_t>(i));
+          break;
+
+        case 'w': case 'W':
+          for (int i = 0; i != 256; ++i)
+            if ((i >= '0' && i <= '9') || (i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z') || i == '_')
+              set.set(static_cast<std::size_t>(i));
+          break;
+
+        case 's': case 'S':
+          for (char space: {' ', '\t', '\n', '\r', '\f', '\v'})
+            set.set(static_cast<unsigned char>(space));
+          break;
+
+        case 't': return literal('\t');
+        case 'n': return literal('\n');
+        case 'r': return literal('\r');
+
+        default:
+          if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+            fail("unsupported escape sequence");
+
+          return literal(c);
+      }
+
+      if (c == 'D' || c == 'W' || c == 'S')
+        set.flip();
+
+      return set;
+    }
+
+    static char first_of(const byte_set& set) noexcept
+    {
+      std::size_t c = 0;
+      while (c != 255 && !set.test(c))
+        ++c;
+
+      return static_cast<char>(c);
+    }
+
+    byte_set char_class()
+    {
+      byte_set set;
+      bool negate = next_is('^');
+      if (negate)
+        take();
+
+      for (bool first = true; first || !next_is(']'); first = false)
+      {
+        byte_set item;
+        char low = take();
+        if (low == '\\')
+        {
+          item = escape();
+          if (item.count() > 2 || next_is('-') == false)
+          {
+            set |= item;
+            continue;
+          }
+
+          low = first_of(item);
+        }
+
+        if (next_is('-') && mText.size() > 1 && mText[1] != ']')
+        {
+          take();
+          char high = take();
+          if (high == '\\')
+            high = first_of(escape());
+
+          if (static_cast<unsigned char>(high) < static_cast<unsigned char>(low))
+            fail("invalid character range");
+
+          for (int i = static_cast<unsigned char>(low); i <= static_cast<unsigned char>(high); ++i)
+            set |= literal(static_cast<char>(i));
+        }
+        else
+          set |= literal(low);
+      }
+
+      take();
+      if (negate)
+        set.flip();
+
+      return set;
+    }
+
+    syntax_tree& mTree;
+    std::string_view mRegex;
+    std::string_view mText;
+    bool mIgnoreCase{false};
+};
+
+
+
+/// Parses a glob into a syntax_tree, anchored at both ends.
+std::size_t parse_glob(syntax_tree& tree, std::string_view glob)
+{
+  byte_set any;
+  any.set();
+
+  byte_set anyButSlash = any;
+  anyButSlash.reset('/');
+
+  node seq{node::concat};
+  seq.children.push_back(tree.add({node::begin_anchor}));
+
+  for (std::size_t pos = 0; pos != glob.size(); ++pos)
+  {
+    node star{node::repeat, 0, {}, 0, -1};
+    if (glob.compare(pos, 3, "**/") == 0)
+    {
+      // Zero or more whole directories.
+      byte_set slash;
+      slash.set('/');
+
+      star.children.push_back(tree.add_bytes(any));
+      node dirs{node::concat};
+      dirs.children.push_back(tree.add(std::move(star)));
+      dirs.children.push_back(tree.add_bytes(slash));
+      seq.children.push_back(tree.add({node::repeat, 0, {tree.add(std::move(dirs))}, 0, 1}));
+      pos += 2;
+    }
+    else if (glob.compare(pos, 2, "**") == 0)
+    {
+      star.children.push_back(tree.add_bytes(any));
+      seq.children.push_back(tree.add(std::move(star)));
+      ++pos;
+    }
+    else if (glob[pos] == '*')
+    {
+      star.children.push_back(tree.add_bytes(anyButSlash));
+      seq.children.push_back(tree.add(std::move(star)));
+    }
+    else if (glob[pos] == '?')
+      seq.children.push_back(tree.add_bytes(anyButSlash));
+    else
+    {
+      byte_set set;
+      set.set(static_cast<unsigned char>(glob[pos]));
+      seq.children.push_back(tree.add_bytes(set));
+    }
+  }
+
+  seq.children.push_back(tree.add({node::end_anchor}));
+  return tree.add(std::move(seq));
+}
+
+
+
+/// A nondeterministic automaton, built from the syntax trees by Thompson's
+/// construction.
+struct nfa
+{
+  struct state
+  {
+    enum kind_type { epsilon, bytes, begin_anchor, end_anchor, match };
+
+    kind_type kind;
+    int out1{-1};
+    int out2{-1};
+    std::size_t set{0};  ///< bytes
+  };
+
+  /// A part of the automaton with one entry and one open exit, an epsilon
+  /// state whose out1 is yet unconnected.
+  struct fragment
+  {
+    int start;
+    int end;
+  };
+
+  const syntax_tree& tree;
+  std::vector<state> states;
+
+  int add(state s)
+  {
+    if (states.size() == maxNfaStates)
+      throw std::runtime_error{"patterns too large"};
+
+    states.push_back(s);
+    return static_cast<int>(states.size() - 1);
+  }
+
+  fragment build(std::size_t index)
+  {
+    auto& n = tree.nodes[index];
+    switch (n.kind)
+    {
+      case node::empty:
+      {
+        int s = add({state::epsilon});
+        return {s, s};
+      }
+
+      case node::bytes:
+      {
+        int e = add({state::epsilon});
+        int s = add({state::bytes, e, -1, n.set});
+        return {s, e};
+      }
+
+      case node::begin_anchor:
+      case node::end_anchor:
+      {
+        int e = add({state::epsilon});
+        int s = add({n.kind == node::begin_anchor ? state::begin_anchor : state::end_anchor, e});
+        return {s, e};
+      }
+
+      case node::concat:
+      {
+        auto result = build(n.children.front());
+        for (std::size_t i = 1; i != n.children.size(); ++i)
+        {
+          auto next = build(n.children[i]);
+          states[static_cast<std::size_t>(result.end)].out1 = next.start;
+          result.end = next.end;
+        }
+
+        return result;
+      }
+
+      case node::alternative:
+      {
+        int e = add({state::epsilon});
+        int s = -1;
+        for (auto child: n.children)
+        {
+          auto alt = build(child);
+          states[static_cast<std::size_t>(alt.end)].out1 = e;
+          s = s == -1 ? alt.start : add({state::epsilon, s, alt.start});
+        }
+
+        return {s, e};
+      }
+
+      case node::repeat:
+      {
+        int s = add({state::epsilon});
+        fragment result{s, s};
+        auto append = [this, &result](int start, int end)
+        {
+          states[static_cast<std::size_t>(result.end)].out1 = start;
+          result.end = end;
+        };
+
+        for (int i = 0; i != n.min; ++i)
+        {
+          auto copy = build(n.children.front());
+          append(copy.start, copy.end);
+        }
+
+        if (n.max == -1)
+        {
+          // loop: split into the child or out, child back to loop
+          auto copy = build(n.children.front());
+          int e     = add({state::epsilon});
+          int loop  = add({state::epsilon, copy.start, e});
+          states[static_cast<std::size_t>(copy.end)].out1 = loop;
+          append(loop, e);
+        }
+        else
+          for (int i = n.min; i != n.max; ++i)
+          {
+            auto copy = build(n.children.front());
+            int e     = add({state::epsilon});
+            int split = add({state::epsilon, copy.start, e});
+            states[static_cast<std::size_t>(copy.end)].out1 = e;
+            append(split, e);
+          }
+
+        return result;
+      }
+    }
+
+    return {-1, -1};
+  }
+};
+
+
+
+/// Builds the deterministic automaton by subset construction.
+class dfa_builder
+{
+  public:
+    dfa_builder(const nfa& nfa, const std::vector<byte_set>& classSets) noexcept
+      : mNfa{nfa},
+        mClassSets{classSets}
+    {}
+
+    /// The sorted set of states reachable from \a from via epsilon moves.
+    /// Anchors are passed at the start or end of the text only, but end
+    /// anchors are kept in the set, to be passed at the end.
+    std::vector<int> closure(std::vector<int> from, bool atStart, bool atEnd)
+    {
+      std::vector<bool> seen(mNfa.states.size());
+      std::vector<int> result;
+
+      while (!from.empty())
+      {
+        int index = from.back();
+        from.pop_back();
+        if (index == -1 || seen[static_cast<std::size_t>(index)])
+          continue;
+
+        seen[static_cast<std::size_t>(index)] = true;
+        auto& s = mNfa.states[static_cast<std::size_t>(index)];
+        switch (s.kind)
+        {
+          case nfa::state::epsilon:
+            from.push_back(s.out1);
+            from.push_back(s.out2);
+            break;
+
+          case nfa::state::begin_anchor:
+            if (atStart)
+              from.push_back(s.out1);
+            break;
+
+          case nfa::state::end_anchor:
+            if (atEnd)
+              from.push_back(s.out1);
+            else
+              result.push_back(index);
+            break;
+
+          case nfa::state::bytes:
+          case nfa::state::match:
+            result.push_back(index);
+            break;
+        }
+      }
+
+      std::sort(result.begin(), result.end());
+      return result;
+    }
+
+    bool matches(const std::vector<int>& states)
+    {
+      for (int index: closure(states, false, true))
+        if (mNfa.states[static_cast<std::size_t>(index)].kind == nfa::state::match)
+          return true;
+
+      return false;
+    }
+
+    /// The states after reading a byte of class \a cls in \a states.
+    std::vector<int> step(const std::vector<int>& states, std::size_t cls)
+    {
+      auto& bytes = mClassSets[cls];
+      std::vector<int> next;
+      for (int index: states)
+      {
+        auto& s = mNfa.states[static_cast<std::size_t>(index)];
+        if (s.kind == nfa::state::bytes && (mNfa.tree.sets[s.set] & bytes).any())
+          next.push_back(s.out1);
+        else if (s.kind == nfa::state::match)
+          next.push_back(index);  // a pattern that matched once stays matched
+      }
+
+      return closure(std::move(next), false, false);
+    }
+
+  private:
+    const nfa& mNfa;
+    const std::vector<byte_set>& mClassSets;
+};
+
+}  // namespace
+
+
+
+void pattern_set::add_regex(std::string_view regex)
+{ mPatterns.push_back({syntax::regex, std::string{regex}}); }
+
+
+void pattern_set::add_glob(std::string_view glob)
+{
+  if (glob.find_first_of("*?") == glob.npos)
+    mLiterals.emplace(glob);
+  else if (glob.ends_with("/**") && glob.substr(0, glob.size() - 3).find_first_of("*?") == glob.npos)
+    mPrefixes.emplace_back(glob.substr(0, glob.size() - 2));
+  else
+    mPatterns.push_back({syntax::glob, std::string{glob}});
+}
+
+
+void pattern_set::add_literal(std::string_view literal)
+{ mLiterals.emplace(literal); }
+
+
+
+void pattern_set::compile()
+{
+  syntax_tree tree;
+  std::vector<std::size_t> roots;
+  for (auto& p: mPatterns)
+    switch (p.kind)
+    {
+      case syntax::regex:
+        roots.push_back(regex_parser{tree, p.text}.parse());
+        break;
+
+      case syntax::glob:
+        roots.push_back(parse_glob(tree, p.text));
+        break;
+    }
+
+  // Unanchored search: any text, then one of the patterns. If all patterns
+  // are anchored at the start, a text may be rejected early.
+  bool anchored = std::all_of(roots.begin(), roots.end(), [&tree](std::size_t root)
+  {
+    auto& n = tree.nodes[root];
+    return n.kind == node::begin_anchor
+      || (n.kind == node::concat && tree.nodes[n.children.front()].kind == node::begin_anchor);
+  });
+
+  byte_set any;
+  any.set();
+  auto anySet = tree.sets.size();
+  tree.sets.push_back(any);
+
+  nfa automaton{tree, {}};
+  int entry    = automaton.add({nfa::state::epsilon});
+  int anyState = automaton.add({nfa::state::bytes, entry, -1, anySet});
+  int choice   = -1;
+  for (auto root: roots)
+  {
+    auto body  = automaton.build(root);
+    int  match = automaton.add({nfa::state::match});
+    automaton.states[static_cast<std::size_t>(body.end)].out1 = match;
+    choice = choice == -1 ? body.start : automaton.add({nfa::state::epsilon, choice, body.start});
+  }
+
+  automaton.states[static_cast<std::size_t>(entry)].out1 = anchored ? -1 : anyState;
+  automaton.states[static_cast<std::size_t>(entry)].out2 = choice;
+
+  // Bytes that no pattern distinguishes share a class.
+  mClasses.fill(0);
+  mClassCount = 1;
+  for (auto& set: tree.sets)
+  {
+    std::map<std::pair<std::uint8_t,bool>,std::uint8_t> refined;
+    std::array<std::uint8_t,256> classes;
+    for (std::size_t c = 0; c != 256; ++c)
+      classes[c] = refined.try_emplace({mClasses[c], set.test(c)}, static_cast<std::uint8_t>(refined.size())).first->second;
+
+    mClasses    = classes;
+    mClassCount = static_cast<std::uint32_t>(refined.size());
+  }
+
+  std::vector<byte_set> classSets(mClassCount);
+  for (std::size_t c = 0; c != 256; ++c)
+    classSets[mClasses[c]].set(c);
+
+  // State 0 is the dead state, without any NFA state.
+  dfa_builder builder{automaton, classSets};
+  std::map<std::vector<int>,std::uint32_t> ids{{{}, dead}};
+  std::vector<std::vector<int>> pending;
+
+  mTransitions.assign(mClassCount, dead);
+  mMatches.assign(1, false);
+
+  auto stateFor = [&](std::vector<int>&& states)
+  {
+    auto [iter, added] = ids.try_emplace(std::move(states), static_cast<std::uint32_t>(ids.size()));
+    if (added)
+    {
+      if (ids.size() > maxStates)
+        throw std::runtime_error{"patterns too complex"};
+
+      mTransitions.resize(mTransitions.size() + mClassCount, dead);
+      mMatches.push_back(builder.matches(iter->first));
+      pending.push_back(iter->first);
+    }
+
+    return iter->second;
+  };
+
+  mStart = stateFor(builder.closure({entry}, true, false));
+  while (!pending.empty())
+  {
+    auto states = std::move(pending.back());
+    pending.pop_back();
+    auto from = ids.at(states);
+
+    for (std::uint32_t cls = 0; cls != mClassCount; ++cls)
+    {
+      auto to = stateFor(builder.step(states, cls));
+      mTransitions[from * mClassCount + cls] = to;
+    }
+  }
+}
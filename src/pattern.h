@@ -0,0 +1,121 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+
+
+/// A set of regular expressions, globs and literals. Literals, and globs
+/// without wildcards, are looked up in a hash table, and globs of the form
+/// `dir/**` compared as prefixes; the other patterns are compiled into one
+/// deterministic automaton. Matching a text against all
+/// patterns at once is a single pass over the text, and does not allocate
+/// memory.
+///
+/// Regular expressions match if they match a part of the text, unless
+/// anchored with `^` and `$`. They support alternatives `|`, groups `(...)`
+/// and `(?:...)`, quantifiers `*`, `+`, `?` and `{n,m}`, the wildcard `.`,
+/// character classes `[...]` and `[^...]`, the escapes `\d`, `\w`, `\s` and
+/// their negations, and the prefix `(?i)` for case insensitive matching.
+/// Back references and look-around assertions are not supported.
+///
+/// Globs and literals must match the whole text. In globs, `*` matches any
+/// characters except `/`, `?` one character except `/`, and `**` any
+/// characters including `/`; `**/` also matches no directory at all.
+class pattern_set
+{
+  public:
+    /// Constructs an empty set, which matches nothing.
+    pattern_set() = default;
+
+    /// Adds the regular expression \a regex.
+    void add_regex(std::string_view regex);
+
+    /// Adds the \a glob pattern.
+    void add_glob(std::string_view glob);
+
+    /// Adds the \a literal text.
+    void add_literal(std::string_view literal);
+
+    /// Compiles the patterns into the automaton. Throws if a pattern is
+    /// invalid or the automaton gets too large.
+    void compile();
+
+    /// The number of patterns.
+    std::size_t size() const noexcept
+    { return mLiterals.size() + mPrefixes.size() + mPatterns.size(); }
+
+    /// Whether the set contains no patterns.
+    bool empty() const noexcept
+    { return mLiterals.empty() && mPrefixes.empty() && mPatterns.empty(); }
+
+    /// Whether any of the patterns matches the \a text. The set must have
+    /// been compiled.
+    bool matches(std::string_view text) const noexcept
+    {
+      if (!mLiterals.empty() && mLiterals.contains(text))
+        return true;
+
+      for (auto& prefix: mPrefixes)
+        if (text.starts_with(prefix))
+          return true;
+
+      std::uint32_t state = mStart;
+      for (unsigned char c: text)
+      {
+        state = mTransitions[state * mClassCount + mClasses[c]];
+        if (state == dead)
+          return false;
+      }
+
+      return mMatches[state];
+    }
+
+  private:
+    enum class syntax { regex, glob };
+    struct pattern
+    {
+      syntax kind;
+      std::string text;
+    };
+
+    struct string_hash
+    {
+      using is_transparent = void;
+
+      std::size_t operator()(std::string_view text) const noexcept
+      { return std::hash<std::string_view>{}(text); }
+    };
+
+    static constexpr std::uint32_t dead = 0;
+
+    std::unordered_set<std::string,string_hash,std::equal_to<>> mLiterals;
+    std::vector<std::string> mPrefixes;  ///< of globs "prefix/**", without the "**"
+    std::vector<pattern> mPatterns;  ///< compiled into the automaton
+    std::array<std::uint8_t,256> mClasses{};
+    std::uint32_t mClassCount{1};
+    std::uint32_t mStart{dead};
+    std::vector<std::uint32_t> mTransitions{0};
+    std::vector<std::uint8_t> mMatches{0};
+};
@@ -21,50 +21,48 @@
 
 
 
-static std::set<std::string_view> string_set_from(config::item configuration)
-{
-  std::set<std::string_view> result;
-
-  if (configuration.is_string())
-    result.insert(configuration.to_string_view());
-  else
-    for (size_t i = 0, endi = configuration.size(); i != endi; ++i)
-      result.insert(configuration[i].to_string_view());
-
-  return result;
-}
-
-
-
 pipeline_hook::pipeline_hook(config::item configuration)
   : hook{configuration},
-    mJobNames{string_set_from(configuration["job_name"])}
+    mJobNames{patterns_from(configuration["job_name"])}
 {
   if (configuration.contains("status"))
-    mStatuses = string_set_from(configuration["status"]);
+    mStatuses = patterns_from(configuration["status"]);
+
+  if (configuration.contains("ref"))
+    mRefs = patterns_from(configuration["ref"]);
 }
 
 
 
-auto pipeline_hook::process(http::request request, const nlohmann::json& json) const -> outcome
+auto pipeline_hook::process(const event& event) const -> outcome
 {
-  if (request.header("X-Gitlab-Event") != "Pipeline Hook")
+  if (event.type != "Pipeline Hook")
     return outcome::ignored;
 
-  auto& status = json.at("object_attributes").at("status").get_ref<const std::string&>();
-  if (!mStatuses.empty() && !mStatuses.contains(status))
+  auto& json = event.json;
+  auto& json_obj_attrs = json.at("object_attributes");
+  auto& status = json_obj_attrs.at("status").get_ref<const std::string&>();
+  if (!mStatuses.empty() && !mStatuses.matches(status))
   {
     log_debug("hook '%s': no matching status '%s'", name.c_str(), status.c_str());
     return outcome::ignored;
   }
 
+  auto& ref = json_obj_attrs.at("ref").get_ref<const std::string&>();
+  if (!mRefs.empty() && !mRefs.matches(ref))
+  {
+    log_debug("hook '%s': no matching ref '%s'", name.c_str(), ref.c_str());
+    return outcome::ignored;
+  }
+
   std::vector<std::string_view> jobNames;
   std::vector<std::string> jobIds;
 
+  // All job name patterns are matched at once, by a single pass over each name.
   for (const auto& job: json.at("builds").get_ref<const nlohmann::json::array_t&>())
   {
     std::string_view jobName{job.at("name").get_ref<const std::string&>()};
-    if (mJobNames.contains(jobName) && job.at("status").get_ref<const std::string&>() == "success")
+    if (mJobNames.matches(jobName) && job.at("status").get_ref<const std::string&>() == "success")
     {
       jobNames.push_back(jobName);
       jobIds.push_back(std::to_string(job.at("id").get<uint64_t>()));
@@ -81,13 +79,12 @@ auto pipeline_hook::process(http::request request, const nlohmann::json& json) c
   environment.set_list("CI_JOB_IDS", jobIds);
   environment.set_list("CI_JOB_NAMES", jobNames);
 
-  auto& json_obj_attrs = json.at("object_attributes");
-  environment.set("CI_COMMIT_REF_NAME", json_obj_attrs.at("ref").get_ref<const std::string&>());
+  environment.set("CI_COMMIT_REF_NAME", ref);
   environment.set("CI_COMMIT_SHA", json_obj_attrs.at("sha").get_ref<const std::string&>());
   environment.set("CI_PIPELINE_ID", std::to_string(json_obj_attrs.at("id").get<uint64_t>()));
 
   if (json_obj_attrs.contains("tag") && json_obj_attrs["tag"].is_string())
     environment.set("CI_COMMIT_TAG", json_obj_attrs["tag"].get_ref<const std::string&>());
 
-  return execute(request, json, std::move(environment));
+  return execute(event, std::move(environment));
 }
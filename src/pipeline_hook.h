@@ -17,7 +17,6 @@
 */
 #pragma once
 #include "hook.h"
-#include <set>
 
 
 
@@ -28,10 +27,10 @@ class pipeline_hook : public hook
     explicit pipeline_hook(config::item configuration);
 
   protected:
-    outcome process(http::request request, const nlohmann::json& json) const override;
+    outcome process(const event& event) const override;
 
   private:
-    std::set<std::string_view> mStatuses;
-    std::set<std::string_view> mJobNames;
-    bool mOnlyOnSuccess;
+    pattern_set mJobNames;
+    pattern_set mStatuses;
+    pattern_set mRefs;
 };
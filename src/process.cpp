@@ -18,6 +18,7 @@
 #include "io_context.h"
 #include "log.h"
 #include "process.h"
+#include "snapshot.h"
 #include <cassert>
 #include <cerrno>
 #include <csignal>
@@ -25,8 +26,12 @@
 #include <cstdlib>
 #include <cstring>
 #include <event2/event.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <utility>
 
 
 
@@ -64,10 +69,15 @@ std::string process_errors::message(int code) const
 struct process::impl
 {
   io_context& io;
-  std::string program;
-  std::vector<std::string> args;
+  std::shared_ptr<const command_line> command;
   environment env;
   user_group user;
+  std::shared_ptr<const std::string> input;
+  input_channel channel{input_channel::none};
+  int childInput{-1};            ///< pipe read end or memory file, passed to the child
+  int inputWriter{-1};           ///< pipe write end
+  std::size_t inputWritten{0};
+  std::unique_ptr<event,free_event> inputEv;
   handler_type handler;
   impl* next{nullptr};
   pid_t pid{-1};
@@ -77,10 +87,23 @@ struct process::impl
   {}
 
   ~impl();
+
+  void openInput();
+  void closeInput() noexcept;
+  pid_t fork(const char* const* argv, const char* const* envp);
+  pid_t vfork(const char* const* argv, const char* const* envp);
+  bool passInput() const noexcept;
+  [[noreturn]] void childFailed(const char* what, int error) const noexcept;
+  void writeInput() noexcept;
+  static void onInputWritable(int, short, void* cls) noexcept;
 };
 
 
 
+static process::spawn_strategy spawnStrategy{process::spawn_strategy::fork};
+
+
+
 class process::list
 {
   public:
@@ -110,10 +133,11 @@ void process::impl_delete::operator()(impl* p) noexcept
 
 process::impl::~impl()
 {
+  closeInput();
   if (pid == -1)
     return;
 
-  log_warning("terminating child process %s", program.c_str());
+  log_warning("terminating child process %s", command->program());
   ::kill(pid, SIGTERM);
 
   for (int i = 0; i <= 5; ++i)
@@ -127,7 +151,7 @@ process::impl::~impl()
 
     if (i == 4)
     {
-      log_warning("killing child process %s", program.c_str());
+      log_warning("killing child process %s", command->program());
       ::kill(pid, SIGKILL);
     }
   }
@@ -135,12 +159,8 @@ process::impl::~impl()
 
 
 
-void process::set_program(std::string program) noexcept
-{ m->program = std::move(program); }
-
-
-void process::set_arguments(std::vector<std::string>&& arguments) noexcept
-{ m->args = std::move(arguments); }
+void process::set_command_line(std::shared_ptr<const command_line> command) noexcept
+{ m->command = std::move(command); }
 
 
 void process::set_environment(environment environment) noexcept
@@ -151,52 +171,346 @@ void process::set_user_group(user_group impersonate) noexcept
 { m->user = std::move(impersonate); }
 
 
+void process::set_input(std::shared_ptr<const std::string> content, input_channel channel) noexcept
+{
+  m->input   = std::move(content);
+  m->channel = m->input ? channel : input_channel::none;
+}
+
+
+
+void process::save(snapshot_writer& out) const
+{
+  assert(m->pid == -1);
+
+  // Program and arguments separately, for compatibility with older versions.
+  std::vector<const char*> argv;
+  m->command->get(argv);
+
+  out.put(std::string_view{argv.front()});
+  out.put(argv.size() - 2);
+  for (std::size_t i = 1; argv[i]; ++i)
+    out.put(std::string_view{argv[i]});
+
+  m->env.save(out);
+  out.put(m->user.uid());
+  out.put(m->user.gid());
+
+  out.put(static_cast<std::uint64_t>(m->channel));
+  out.put(m->input ? std::string_view{*m->input} : std::string_view{});
+}
+
+
+
+void process::restore(snapshot_reader& in)
+{
+  auto command = std::make_shared<command_line>();
+  command->add(in.get_string());
+
+  for (auto count = in.get_uint(); count; --count)
+    command->add(in.get_string());
+
+  m->command = std::move(command);
+
+  m->env.restore(in);
+
+  auto uid = static_cast<unsigned int>(in.get_uint());
+  auto gid = static_cast<unsigned int>(in.get_uint());
+  m->user  = user_group{uid, gid};
+
+  auto channel = in.get_uint();
+  auto content = in.get_string();
+  if (channel > static_cast<std::uint64_t>(input_channel::memfd))
+    throw std::runtime_error{"invalid input channel in snapshot"};
+
+  if (channel != static_cast<std::uint64_t>(input_channel::none))
+    set_input(std::make_shared<const std::string>(content), static_cast<input_channel>(channel));
+}
+
+
+
+void process::set_spawn_strategy(spawn_strategy strategy) noexcept
+{ spawnStrategy = strategy; }
+
+
 
 void process::start(handler_type handler)
 {
-  pid_t pid = fork();
-  if (pid == -1)
-    throw std::system_error{errno, std::system_category(), "failed to fork child process"};
+  // Prepared here, so that the child only has to make system calls.
+  std::vector<const char*> args;
+  m->command->get(args);
 
-  if (pid != 0)
+  auto env = m->env.get();
+
+  // Before forking, so that SIGCHLD is already handled when the child exits.
+  auto& children = list::singleton(m->io);
+
+  pid_t pid;
+  try {
+    m->openInput();
+    if (spawnStrategy == spawn_strategy::vfork)
+      pid = m->vfork(args.data(), env.data());
+    else
+      pid = m->fork(args.data(), env.data());
+  }
+  catch (...)
+  {
+    m->closeInput();
+    throw;
+  }
+
+  close(std::exchange(m->childInput, -1));
+  if (m->inputWriter == -1)
+    m->input.reset();
+
+  m->handler = std::move(handler);
+  m->pid     = pid;
+
+  children.add(m.get());
+
+  if (m->inputWriter != -1)
+    m->writeInput();
+}
+
+
+
+void process::impl::openInput()
+{
+  if (channel == input_channel::pipe)
+  {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+      throw std::system_error{errno, std::system_category(), "failed to create input pipe"};
+
+    childInput  = fds[0];
+    inputWriter = fds[1];
+    if (fcntl(inputWriter, F_SETFL, O_NONBLOCK) == -1)
+      throw std::system_error{errno, std::system_category(), "failed to create input pipe"};
+  }
+  else if (channel == input_channel::memfd)
   {
-    // In parent process
-    m->handler = std::move(handler);
-    m->pid     = pid;
+    childInput = memfd_create("gitlab-hook-payload", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+    if (childInput == -1)
+      throw std::system_error{errno, std::system_category(), "failed to create input memory file"};
+
+    for (std::size_t offset = 0; offset != input->size();)
+    {
+      auto n = pwrite(childInput, input->data() + offset, input->size() - offset, static_cast<off_t>(offset));
+      if (n == -1 && errno != EINTR)
+        throw std::system_error{errno, std::system_category(), "failed to write input memory file"};
+
+      if (n > 0)
+        offset += static_cast<std::size_t>(n);
+    }
+
+    if (fcntl(childInput, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) == -1)
+      throw std::system_error{errno, std::system_category(), "failed to seal input memory file"};
+  }
+}
+
+
+
+void process::impl::closeInput() noexcept
+{
+  inputEv.reset();
+  if (childInput != -1)
+    close(std::exchange(childInput, -1));
+
+  if (inputWriter != -1)
+    close(std::exchange(inputWriter, -1));
+}
+
+
+
+bool process::impl::passInput() const noexcept
+{
+  // Only async-signal-safe functions here, see vfork().
+  if (childInput == -1)
+    return true;
+
+  int target = channel == input_channel::pipe ? STDIN_FILENO : memfd_descriptor;
+  if (childInput == target)
+    return fcntl(target, F_SETFD, 0) != -1;
 
-    list::singleton(m->io).add(m.get());
+  return dup2(childInput, target) != -1;
+}
+
+
+
+void process::impl::writeInput() noexcept
+{
+  // A child that exits without reading all of its input must not kill this
+  // process with SIGPIPE.
+  sigset_t sigpipe, oldMask;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &oldMask);
+
+  bool full = false;
+  while (inputWritten != input->size())
+  {
+    auto n = write(inputWriter, input->data() + inputWritten, input->size() - inputWritten);
+    if (n >= 0)
+      inputWritten += static_cast<std::size_t>(n);
+    else if (errno == EAGAIN)
+    {
+      full = true;
+      break;
+    }
+    else if (errno != EINTR)
+    {
+      if (errno == EPIPE)
+      {
+        timespec noWait{};
+        sigtimedwait(&sigpipe, nullptr, &noWait);
+      }
+      else
+        log_warning("failed to write input of child process %s: %s", command->program(), strerror(errno));
+
+      break;
+    }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+
+  if (!full)
+  {
+    closeInput();
+    input.reset();
     return;
   }
 
+  if (!inputEv)
+    inputEv.reset(io.new_event<&onInputWritable>(inputWriter, EV_WRITE|EV_PERSIST, this, "process::impl::onInputWritable"));
+
+  event_add(inputEv.get(), nullptr);
+}
+
+
+
+void process::impl::onInputWritable(int, short, void* cls) noexcept
+{ static_cast<impl*>(cls)->writeInput(); }
+
+
+
+pid_t process::impl::fork(const char* const* argv, const char* const* envp)
+{
+  pid_t pid = ::fork();
+  if (pid == -1)
+    throw std::system_error{errno, std::system_category(), "failed to fork child process"};
+
+  if (pid != 0)
+    return pid;
+
   // In child process...
   try {
     sigset_t sigMask;
     sigfillset(&sigMask);
     sigprocmask(SIG_UNBLOCK, &sigMask, nullptr);
 
-    std::vector<const char*> args;
-    args.reserve(m->args.size() + 2);
-    args.push_back(m->program.c_str());
-    for (const auto& arg: m->args)
-      args.push_back(arg.c_str());
-    args.push_back(nullptr);
+    if (!passInput())
+      throw std::system_error{errno, std::system_category(), "failed to pass input"};
 
-    if (m->user)
-      m->user.impersonate();
+    if (user)
+      user.impersonate();
 
-    auto env = m->env.get();
-    execve(m->program.c_str(), const_cast<char* const*>(args.data()), const_cast<char* const*>(env.data()));
+    execve(command->program(), const_cast<char* const*>(argv), const_cast<char* const*>(envp));
     throw std::system_error{errno, std::system_category()};
   }
   catch (const std::exception& e)
   {
-    fprintf(stderr, "execute %s failed: %s\n", m->program.c_str(), e.what());
+    fprintf(stderr, "execute %s failed: %s\n", command->program(), e.what());
     std::exit(-1);
   }
 }
 
 
 
+pid_t process::impl::vfork(const char* const* argv, const char* const* envp)
+{
+  static_assert(sizeof(gid_t) == sizeof(unsigned int));
+  std::vector<unsigned int> groups;
+  if (user)
+    groups = user.supplementary_groups();
+
+  // The child borrows this process's memory and stack until it executes the
+  // program, so it must not run any of our signal handlers.
+  sigset_t allSignals, oldMask;
+  sigfillset(&allSignals);
+  pthread_sigmask(SIG_SETMASK, &allSignals, &oldMask);
+
+  pid_t pid = ::vfork();
+  if (pid == 0)
+  {
+    // In child process, which must neither allocate memory nor return...
+    for (int signo = 1; signo < NSIG; ++signo)
+    {
+      struct sigaction action;
+      if (sigaction(signo, nullptr, &action) == 0 && action.sa_handler != SIG_IGN && action.sa_handler != SIG_DFL)
+      {
+        action.sa_handler = SIG_DFL;
+        action.sa_flags   = 0;
+        sigaction(signo, &action, nullptr);
+      }
+    }
+
+    sigset_t noSignals;
+    sigemptyset(&noSignals);
+    sigprocmask(SIG_SETMASK, &noSignals, nullptr);
+
+    if (!passInput())
+      childFailed("failed to pass input", errno);
+
+    // NOTE: The libc wrappers of setuid() etc. would synchronize with the threads of the parent.
+    if (user)
+    {
+      if (syscall(SYS_setgroups, groups.size(), groups.data()) == -1)
+        childFailed("failed to set additional process groups", errno);
+
+      if (syscall(SYS_setresgid, user.gid(), user.gid(), user.gid()) == -1)
+        childFailed("failed to set process group id", errno);
+
+      if (syscall(SYS_setresuid, user.uid(), user.uid(), user.uid()) == -1)
+        childFailed("failed to set process user id", errno);
+    }
+
+    execve(command->program(), const_cast<char* const*>(argv), const_cast<char* const*>(envp));
+    childFailed(nullptr, errno);
+  }
+
+  int error = errno;
+  pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+
+  if (pid == -1)
+    throw std::system_error{error, std::system_category(), "failed to fork child process"};
+
+  return pid;
+}
+
+
+
+void process::impl::childFailed(const char* what, int error) const noexcept
+{
+  // Only async-signal-safe functions here, see vfork().
+  auto put = [](const char* text) noexcept
+  { [[maybe_unused]] auto n = write(STDERR_FILENO, text, strlen(text)); };
+
+  put("execute ");
+  put(command->program());
+  put(" failed: ");
+  if (what)
+  {
+    put(what);
+    put(": ");
+  }
+
+  put(strerrordesc_np(error) ? strerrordesc_np(error) : "unknown error");
+  put("\n");
+  _exit(-1);
+}
+
+
+
 void process::terminate() noexcept
 {
   assert(m->pid != -1);
@@ -229,7 +543,7 @@ process::list& process::list::singleton(io_context& context)
 
 
 process::list::list(io_context& context) noexcept
-  : mSigchld{event_new(context.native_handle(), SIGCHLD, EV_SIGNAL|EV_PERSIST, &onSigchld, this)}
+  : mSigchld{context.new_event<&onSigchld>(SIGCHLD, EV_SIGNAL|EV_PERSIST, this, "process::list::onSigchld")}
 {
   event_add(mSigchld, nullptr);
 }
@@ -305,20 +619,63 @@ void process::list::onSigchld(int, short, void* cls) noexcept
 
 
 
+void process::command_line::add(std::string_view argument)
+{
+  append(argument);
+  mBuffer.push_back('\0');
+  ++mSize;
+}
+
+
+
+void process::command_line::append(std::string_view text)
+{ mBuffer.append(text.substr(0, text.find('\0'))); }
+
+
+
+void process::command_line::get(std::vector<const char*>& argv) const
+{
+  argv.reserve(argv.size() + mSize + 1);
+  for (std::size_t pos = 0, i = 0; i != mSize; ++i)
+  {
+    argv.push_back(mBuffer.data() + pos);
+    pos = mBuffer.find('\0', pos) + 1;
+  }
+
+  argv.push_back(nullptr);
+}
+
+
+
+void process::environment::set_base(std::shared_ptr<const environment> base) noexcept
+{ mBase = std::move(base); }
+
+
+
+inline void process::environment::append(std::string_view text)
+{
+  // A null character would end the entry early, and start another one.
+  mBuffer.append(text.substr(0, text.find('\0')));
+}
+
+
+
 void process::environment::set(std::string_view entry)
-{ mEntries.push_back(std::string{entry}); }
+{
+  append(entry);
+  mBuffer.push_back('\0');
+  ++mSize;
+}
 
 
 
 void process::environment::set(std::string_view var, std::string_view value)
 {
-  std::string entry;
-  entry.reserve(var.size() + 1 + value.size());
-  entry.append(var);
-  entry.push_back('=');
-  entry.append(value);
-
-  mEntries.push_back(std::move(entry));
+  append(var);
+  mBuffer.push_back('=');
+  append(value);
+  mBuffer.push_back('\0');
+  ++mSize;
 }
 
 
@@ -326,23 +683,37 @@ void process::environment::set(std::string_view var, std::string_view value)
 template<typename Container>
 void process::environment::set_list(std::string_view var, const Container& values)
 {
-  size_t size = var.size() + 1;
-  for (std::string_view value: values)
-    size += value.size() + 1;
-
-  std::string entry;
-  entry.reserve(size);
-  entry.append(var);
+  append(var);
 
   char sep = '=';
   for (std::string_view value: values)
   {
-    entry.push_back(sep);
-    entry.append(value.data(), value.size());
+    mBuffer.push_back(sep);
+    append(value);
     sep = ' ';
   }
 
-  mEntries.push_back(std::move(entry));
+  if (sep == '=')
+    mBuffer.push_back(sep);
+
+  mBuffer.push_back('\0');
+  ++mSize;
+}
+
+
+
+std::string_view process::environment::value(std::string_view name) const noexcept
+{
+  for (std::size_t pos = 0, i = 0; i != mSize; ++i)
+  {
+    std::string_view entry{mBuffer.data() + pos};
+    if (entry.size() > name.size() && entry.starts_with(name) && entry[name.size()] == '=')
+      return entry.substr(name.size() + 1);
+
+    pos += entry.size() + 1;
+  }
+
+  return mBase ? mBase->value(name) : std::string_view{};
 }
 
 
@@ -350,10 +721,14 @@ void process::environment::set_list(std::string_view var, const Container& value
 std::vector<const char*> process::environment::get() const
 {
   std::vector<const char*> result;
-  result.reserve(mEntries.size() + 1);
+  result.reserve(mSize + (mBase ? mBase->mSize : 0) + 1);
 
-  for (auto& entry: mEntries)
-    result.push_back(entry.c_str());
+  for (auto env = this; env; env = env->mBase.get())
+    for (std::size_t pos = 0, i = 0; i != env->mSize; ++i)
+    {
+      result.push_back(env->mBuffer.data() + pos);
+      pos = env->mBuffer.find('\0', pos) + 1;
+    }
 
   result.push_back(nullptr);
   return result;
@@ -361,5 +736,27 @@ std::vector<const char*> process::environment::get() const
 
 
 
+void process::environment::save(snapshot_writer& out) const
+{
+  auto entries = get();
+  out.put(entries.size() - 1);
+  for (std::size_t i = 0; entries[i]; ++i)
+    out.put(std::string_view{entries[i]});
+}
+
+
+
+void process::environment::restore(snapshot_reader& in)
+{
+  mBuffer.clear();
+  mSize = 0;
+  mBase.reset();
+
+  for (auto count = in.get_uint(); count; --count)
+    set(in.get_string());
+}
+
+
+
 template void process::environment::set_list(std::string_view, const std::vector<std::string>&);
 template void process::environment::set_list(std::string_view, const std::vector<std::string_view>&);
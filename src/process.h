@@ -24,6 +24,8 @@
 #include <system_error>
 #include <vector>
 class io_context;
+class snapshot_reader;
+class snapshot_writer;
 
 
 
@@ -31,9 +33,29 @@ class io_context;
 class process
 {
   public:
+    class command_line;
     class environment;
     using handler_type = std::function<void(std::error_code, int)>;
 
+    /// How start() creates the child process.
+    enum class spawn_strategy
+    {
+      fork,   ///< fork() copies the page tables, then the child prepares and executes
+      vfork   ///< vfork() suspends this process until the child executed
+    };
+
+    /// How set_input() passes content to the child process.
+    enum class input_channel
+    {
+      none,   ///< no content, the child inherits standard input
+      pipe,   ///< as standard input, through a pipe written by the I/O context
+      memfd   ///< as descriptor memfd_descriptor, a sealed memory file that can be mapped and read repeatedly
+    };
+
+    /// The descriptor of the memory file in the child process, see
+    /// input_channel::memfd.
+    static constexpr int memfd_descriptor = 3;
+
     /// Creates a null object.
     constexpr process() noexcept = default;
 
@@ -51,11 +73,9 @@ class process
     explicit operator bool() const noexcept
     { return !!m; }
 
-    /// Sets the \a program to start.
-    void set_program(std::string program) noexcept;
-
-    /// Sets the command-line \a arguments for the child process.
-    void set_arguments(std::vector<std::string>&& arguments) noexcept;
+    /// Sets the \a command to start, which may be shared with other
+    /// processes.
+    void set_command_line(std::shared_ptr<const command_line> command) noexcept;
 
     /// Sets the \a environment the child process will execute in.
     void set_environment(environment environment) noexcept;
@@ -64,10 +84,26 @@ class process
     /// its access rights from.
     void set_user_group(user_group impersonate) noexcept;
 
+    /// Passes the \a content, which may be shared with other processes, to
+    /// the child process through the \a channel.
+    void set_input(std::shared_ptr<const std::string> content, input_channel channel) noexcept;
+
+    /// Writes program, arguments, environment, user and input of the
+    /// process, which must not have been started yet, to \a out.
+    void save(snapshot_writer& out) const;
+
+    /// Reads program, arguments, environment, user and input of the process
+    /// from \a in, as written by save().
+    void restore(snapshot_reader& in);
+
     /// Starts the child process. The \a handler will be executed when the
     /// process finishes or execution fails somehow.
     void start(handler_type handler);
 
+    /// Sets the \a strategy with which start() creates child processes from
+    /// now on. The default is spawn_strategy::fork.
+    static void set_spawn_strategy(spawn_strategy strategy) noexcept;
+
     /// Attempts to terminate the child process.
     void terminate() noexcept;
 
@@ -89,7 +125,42 @@ class process
 
 
 
-/// The environment of a child process.
+/// The program and arguments of a child process, stored one after the other
+/// in a single buffer, each terminated by a null character.
+class process::command_line
+{
+  public:
+    command_line() noexcept = default;
+
+    /// Appends the \a argument. The first argument is the program, which
+    /// must be given with full path.
+    void add(std::string_view argument);
+
+    /// Appends \a text to the argument that the next add() completes.
+    void append(std::string_view text);
+
+    /// The number of arguments, including the program.
+    std::size_t size() const noexcept
+    { return mSize; }
+
+    /// The program, or an empty string if there are no arguments.
+    const char* program() const noexcept
+    { return mBuffer.c_str(); }
+
+    /// Appends the arguments, as needed for execve(), to \a argv, including
+    /// termination.
+    void get(std::vector<const char*>& argv) const;
+
+  private:
+    std::string mBuffer;
+    std::size_t mSize{0};
+};
+
+
+
+/// The environment of a child process. The entries are stored one after the
+/// other in a single buffer, each terminated by a null character, followed by
+/// the entries of an optional, shared base environment.
 class process::environment
 {
   public:
@@ -97,6 +168,10 @@ class process::environment
     environment(environment&&) noexcept = default;
     environment& operator=(environment&&) noexcept = default;
 
+    /// Sets the \a base environment, whose entries follow the entries of
+    /// this environment without being copied.
+    void set_base(std::shared_ptr<const environment> base) noexcept;
+
     /// Adds an environment variable \a entry, which must have the format
     /// `NAME=value`. If the value is empty, the `=` must still be present.
     void set(std::string_view entry);
@@ -109,11 +184,26 @@ class process::environment
     template<typename Container>
     void set_list(std::string_view name, const Container& values);
 
+    /// The value of the first environment variable \a name, or an empty
+    /// string if there is none.
+    std::string_view value(std::string_view name) const noexcept;
+
     /// The environment, as needed for execve(), including termination.
     std::vector<const char*> get() const;
 
+    /// Writes the environment to \a out.
+    void save(snapshot_writer& out) const;
+
+    /// Reads the environment from \a in, as written by save().
+    void restore(snapshot_reader& in);
+
   private:
-    std::vector<std::string> mEntries;
+    /// Appends \a text to the buffer, up to its first null character.
+    void append(std::string_view text);
+
+    std::string mBuffer;
+    std::size_t mSize{0};
+    std::shared_ptr<const environment> mBase;
 };
 
 extern template void process::environment::set_list(std::string_view, const std::vector<std::string>&);
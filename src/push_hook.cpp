@@ -0,0 +1,109 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "log.h"
+#include "push_hook.h"
+#include <nlohmann/json.hpp>
+
+
+
+push_hook::push_hook(config::item configuration, bool tags)
+  : hook{configuration},
+    mEventType{tags ? "Tag Push Hook" : "Push Hook"},
+    mRefPrefix{tags ? "refs/tags/" : "refs/heads/"}
+{
+  if (configuration.contains("ref"))
+    mRefs = patterns_from(configuration["ref"]);
+
+  if (configuration.contains("paths"))
+    mPaths = patterns_from(configuration["paths"]);
+}
+
+
+
+auto push_hook::process(const event& event) const -> outcome
+{
+  if (event.type != mEventType)
+    return outcome::ignored;
+
+  auto& json  = event.json;
+  auto& ref   = json.at("ref").get_ref<const std::string&>();
+  auto& after = json.at("after").get_ref<const std::string&>();
+
+  if (after.find_first_not_of('0') == after.npos)
+  {
+    log_debug("hook '%s': ref '%s' was deleted", name.c_str(), ref.c_str());
+    return outcome::ignored;
+  }
+
+  std::string_view refName{ref};
+  if (refName.starts_with(mRefPrefix))
+    refName.remove_prefix(mRefPrefix.size());
+
+  if (!mRefs.empty() && !mRefs.matches(refName))
+  {
+    log_debug("hook '%s': no matching ref '%s'", name.c_str(), ref.c_str());
+    return outcome::ignored;
+  }
+
+  if (!mPaths.empty() && !matchesPaths(json))
+  {
+    log_debug("hook '%s': no matching paths changed", name.c_str());
+    return outcome::ignored;
+  }
+
+  process::environment environment;
+  environment.set("CI_COMMIT_REF_NAME", refName);
+  environment.set("CI_COMMIT_SHA", after);
+  environment.set("CI_COMMIT_BEFORE_SHA", json.at("before").get_ref<const std::string&>());
+
+  if (mEventType == "Tag Push Hook")
+    environment.set("CI_COMMIT_TAG", refName);
+  else
+    environment.set("CI_COMMIT_BRANCH", refName);
+
+  return execute(event, std::move(environment));
+}
+
+
+
+bool push_hook::matchesPaths(const nlohmann::json& json) const
+{
+  auto& commits = json.at("commits").get_ref<const nlohmann::json::array_t&>();
+  for (const auto& commit: commits)
+    for (auto list: {"added", "modified", "removed"})
+    {
+      auto paths = commit.find(list);
+      if (paths == commit.end() || !paths->is_array())
+        continue;
+
+      for (const auto& path: paths->get_ref<const nlohmann::json::array_t&>())
+        if (path.is_string() && mPaths.matches(path.get_ref<const std::string&>()))
+          return true;
+    }
+
+  // Gitlab includes at most 20 commits in the event. Changes in the others
+  // are unknown, so they might match.
+  auto total = json.find("total_commits_count");
+  if (total != json.end() && total->is_number_unsigned() && total->get<std::size_t>() > commits.size())
+  {
+    log_debug("hook '%s': event lists only %zu of %zu commits, assuming a matching path changed", name.c_str(), commits.size(), total->get<std::size_t>());
+    return true;
+  }
+
+  return false;
+}
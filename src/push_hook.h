@@ -0,0 +1,42 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "hook.h"
+#include "pattern.h"
+
+
+
+/// A webhook for the Gitlab "push event" or "tag push event".
+class push_hook : public hook
+{
+  public:
+    /// Constructs a hook for tag push events if \a tags is set, otherwise
+    /// for push events to branches.
+    push_hook(config::item configuration, bool tags);
+
+  protected:
+    outcome process(const event& event) const override;
+
+  private:
+    bool matchesPaths(const nlohmann::json& json) const;
+
+    std::string_view mEventType;
+    std::string_view mRefPrefix;
+    pattern_set mRefs;
+    pattern_set mPaths;
+};
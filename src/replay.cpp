@@ -0,0 +1,159 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "action_list.h"
+#include "capture.h"
+#include "hook.h"
+#include "io_context.h"
+#include "log.h"
+#include "metrics.h"
+#include "replay.h"
+#include <iomanip>
+#include <nlohmann/json.hpp>
+#include <ostream>
+#include <thread>
+
+
+
+replay::replay(const config::file& configuration)
+  : mIo{std::make_unique<io_context>()},
+    mActions{std::make_unique<action_list>(*mIo)}
+{
+  metrics::reset_hooks();
+
+  auto hooksCfg = configuration["hooks"];
+  hook::init_global(configuration.root());
+
+  for (size_t i = 0, endi = hooksCfg.size(); i != endi; ++i)
+  {
+    auto nhook = hook::create(hooksCfg[i]);
+    auto same  = mHooksByPath.find(nhook->uri_path);
+    if (same == mHooksByPath.end())
+    {
+      mHooksByPath.emplace(nhook->uri_path, nhook.get());
+      mHooks.emplace_back(std::move(nhook));
+    }
+    else
+      same->second->chain(std::move(nhook));
+  }
+}
+
+
+
+replay::~replay()
+{
+  // The hooks must go before the action list.
+  mHooks.clear();
+}
+
+
+
+void replay::run(const std::string& fileName, double speed)
+{
+  using clock = std::chrono::steady_clock;
+
+  capture_reader in{fileName};
+  captured_request request;
+  std::chrono::system_clock::time_point firstRecorded;
+  clock::time_point firstReplayed;
+
+  auto start = clock::now();
+  while (in.next(request))
+  {
+    if (speed > 0)
+    {
+      if (firstRecorded == std::chrono::system_clock::time_point{})
+      {
+        firstRecorded = request.time;
+        firstReplayed = clock::now();
+      }
+
+      auto due = std::chrono::duration_cast<clock::duration>((request.time - firstRecorded) / speed);
+      std::this_thread::sleep_until(firstReplayed + due);
+    }
+
+    ++mRequests;
+    auto iter = mHooksByPath.find(request.path);
+    if (iter == mHooksByPath.end())
+    {
+      ++mNotFound;
+      continue;
+    }
+
+    // Tokens are usually redacted in captures, then any hook authorizes.
+    std::optional<std::string_view> token = request.header("X-Gitlab-Token");
+    if (token == "[redacted]")
+      token.reset();
+
+    auto& chain = *iter->second;
+    if (!chain.authorizes(token, request.peer))
+    {
+      ++mForbidden;
+      continue;
+    }
+
+    auto begin = clock::now();
+    try {
+      auto json = nlohmann::json::parse(request.body);
+
+      // A dry run, in which hooks only log the commands they would execute.
+      auto count = chain.dispatch(hook::event{request.header("X-Gitlab-Event"), json, {}, nullptr, true}, token, request.peer);
+      if (count)
+        ++mAccepted;
+      else
+        ++mIgnored;
+    }
+    catch (const std::exception& e)
+    {
+      log_warning("invalid request to %s: %s", request.path.c_str(), e.what());
+      ++mInvalid;
+    }
+
+    mProcessingTime += clock::now() - begin;
+  }
+
+  mTotalTime += clock::now() - start;
+}
+
+
+
+void replay::report(std::ostream& out) const
+{
+  using seconds = std::chrono::duration<double>;
+  auto processing = seconds{mProcessingTime}.count();
+  auto total      = seconds{mTotalTime}.count();
+  auto processed  = mAccepted + mIgnored + mInvalid;
+
+  out << std::fixed << std::setprecision(3)
+      << "replayed " << mRequests << " requests in " << total << " s\n"
+      << "  not found " << mNotFound << ", forbidden " << mForbidden << ", invalid " << mInvalid
+      << ", ignored " << mIgnored << ", accepted " << mAccepted << "\n"
+      << std::setprecision(0)
+      << "  parsed and processed " << (processing > 0 ? static_cast<double>(processed) / processing : 0.0)
+      << " events/s, " << (total > 0 ? static_cast<double>(mRequests) / total : 0.0) << " requests/s overall\n\n";
+
+  std::size_t width = 4;
+  for (auto& stats: metrics::hooks())
+    width = std::max(width, stats.name.size());
+
+  out << std::left << std::setw(static_cast<int>(width)) << "hook" << std::right
+      << std::setw(10) << "requests" << std::setw(10) << "accepted" << std::setw(10) << "ignored" << "\n";
+
+  for (auto& stats: metrics::hooks())
+    out << std::left << std::setw(static_cast<int>(width)) << stats.name << std::right
+        << std::setw(10) << stats.requests << std::setw(10) << stats.accepted << std::setw(10) << stats.ignored << "\n";
+}
@@ -0,0 +1,67 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "config.h"
+#include <chrono>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+class hook;
+class io_context;
+class action_list;
+
+
+
+/// Drives requests from capture files through the hooks of a configuration,
+/// as if they were received via HTTP, but without executing any commands.
+class replay
+{
+  public:
+    /// Creates the hooks of the \a configuration.
+    explicit replay(const config::file& configuration);
+    ~replay();
+
+    /// Replays the requests of the capture file with given \a fileName. If
+    /// \a speed is positive, paces the requests at \a speed times the rate
+    /// they were recorded with, otherwise replays them as fast as possible.
+    void run(const std::string& fileName, double speed = 0);
+
+    /// Writes the number of requests and their results, the throughput of
+    /// the hooks, and the statistics of each hook to \a out.
+    void report(std::ostream& out) const;
+
+  private:
+    replay(const replay&) = delete;
+    replay& operator=(const replay&) = delete;
+
+    std::unique_ptr<io_context> mIo;
+    std::unique_ptr<action_list> mActions;
+    std::vector<std::unique_ptr<hook>> mHooks;
+    std::map<std::string,hook*,std::less<>> mHooksByPath;
+
+    std::size_t mRequests{0};
+    std::size_t mNotFound{0};
+    std::size_t mForbidden{0};
+    std::size_t mInvalid{0};
+    std::size_t mIgnored{0};
+    std::size_t mAccepted{0};
+    std::chrono::steady_clock::duration mProcessingTime{};
+    std::chrono::steady_clock::duration mTotalTime{};
+};
@@ -23,16 +23,6 @@
 
 
 
-struct free_event
-{
-  constexpr free_event() noexcept = default;
-
-  void operator()(event* p) noexcept
-  { event_free(p); }
-};
-
-
-
 struct signal_listener::impl
 {
   io_context& io;
@@ -67,7 +57,7 @@ void signal_listener::add(std::initializer_list<int> numbers)
   {
     assert(!m->sigs.contains(number));
 
-    auto ev = event_new(m->io.native_handle(), number, EV_SIGNAL|EV_PERSIST, &impl::callback, m.get());
+    auto ev = m->io.new_event<&impl::callback>(number, EV_SIGNAL|EV_PERSIST, m.get(), "signal_listener::callback");
     m->sigs.try_emplace(number, std::unique_ptr<event,free_event>{ev});
     event_add(ev, nullptr);
   }
@@ -0,0 +1,59 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "snapshot.h"
+#include <cstring>
+#include <stdexcept>
+
+
+
+void snapshot_writer::put(std::uint64_t value)
+{ mData.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+
+
+void snapshot_writer::put(std::string_view value)
+{
+  put(static_cast<std::uint64_t>(value.size()));
+  mData.append(value);
+}
+
+
+
+std::uint64_t snapshot_reader::get_uint()
+{
+  std::uint64_t value;
+  if (mData.size() < sizeof(value))
+    throw std::runtime_error{"truncated snapshot"};
+
+  memcpy(&value, mData.data(), sizeof(value));
+  mData.remove_prefix(sizeof(value));
+  return value;
+}
+
+
+
+std::string_view snapshot_reader::get_string()
+{
+  auto size = get_uint();
+  if (mData.size() < size)
+    throw std::runtime_error{"truncated snapshot"};
+
+  auto result = mData.substr(0, size);
+  mData.remove_prefix(size);
+  return result;
+}
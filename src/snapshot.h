@@ -0,0 +1,68 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+
+/// Writes values into a binary buffer, for passing state to another instance
+/// of this program on the same machine.
+class snapshot_writer
+{
+  public:
+    /// Appends an integer \a value.
+    void put(std::uint64_t value);
+
+    /// Appends a string \a value.
+    void put(std::string_view value);
+
+    /// The buffer written so far.
+    const std::string& data() const noexcept
+    { return mData; }
+
+  private:
+    std::string mData;
+};
+
+
+
+/// Reads values from a binary buffer written by a snapshot_writer. Throws if
+/// the buffer ends prematurely.
+class snapshot_reader
+{
+  public:
+    /// Constructs the reader for the buffer \a data.
+    explicit snapshot_reader(std::string_view data) noexcept
+      : mData{data}
+    {}
+
+    /// Whether all values have been read.
+    bool at_end() const noexcept
+    { return mData.empty(); }
+
+    /// Reads an integer value.
+    std::uint64_t get_uint();
+
+    /// Reads a string value. The result refers to the underlying buffer.
+    std::string_view get_string();
+
+  private:
+    std::string_view mData;
+};
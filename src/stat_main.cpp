@@ -0,0 +1,175 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "stats_segment.h"
+#include <boost/program_options.hpp>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+
+
+struct command_line
+{
+  command_line(int argc, char** argv);
+
+  std::string statsFile;
+};
+
+
+
+command_line::command_line(int argc, char** argv)
+{
+  using namespace boost::program_options;
+
+  options_description options{"Options:"};
+  options.add_options()
+      ("help,h", "Show this help.")
+      ("version", "Show version information.")
+      ("file", value<std::string>(&statsFile)->default_value(DEFAULT_STATS_FILE), "Sets the stats file to read.");
+
+  variables_map vm;
+  store(parse_command_line(argc, argv, options), vm);
+  notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << EXECUTABLE" [OPTION]...\n\n"
+              << "Prints the statistics that gitlab-hook publishes in its stats file. Reading\n"
+              << "the file does not involve the running gitlab-hook process.\n\n"
+              << options;
+    std::exit(0);
+  }
+
+  if (vm.count("version"))
+  {
+    std::cout << VERSION"\n";
+    std::exit(0);
+  }
+}
+
+
+
+static const stats_segment_data* map_stats_file(const std::string& fileName)
+{
+  int fd = open(fileName.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd == -1)
+    throw std::system_error{errno, std::system_category(), "failed to open " + fileName};
+
+  struct stat info;
+  if (fstat(fd, &info) == -1 || static_cast<size_t>(info.st_size) < sizeof(stats_segment_data))
+  {
+    close(fd);
+    throw std::runtime_error{fileName + " is not a gitlab-hook stats file"};
+  }
+
+  auto addr = mmap(nullptr, sizeof(stats_segment_data), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (addr == MAP_FAILED)
+    throw std::system_error{errno, std::system_category(), "failed to map " + fileName};
+
+  auto data = static_cast<const stats_segment_data*>(addr);
+  if (memcmp(data->magic, stats_segment_data::magicValue, sizeof(data->magic)) != 0)
+    throw std::runtime_error{fileName + " is not a gitlab-hook stats file"};
+
+  if (data->version != stats_segment_data::currentVersion || data->hookCapacity != stats_segment_data::maxHooks)
+    throw std::runtime_error{fileName + " has an incompatible version"};
+
+  return data;
+}
+
+
+
+static void read_snapshot(const stats_segment_data& shared, stats_segment_data& copy)
+{
+  for (int retries = 0; retries != 1000; ++retries)
+  {
+    auto seq1 = shared.sequence.load(std::memory_order_acquire);
+    if (seq1 & 1)
+    {
+      usleep(100);
+      continue;
+    }
+
+    memcpy(static_cast<void*>(&copy), &shared, sizeof(copy));
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    auto seq2 = shared.sequence.load(std::memory_order_relaxed);
+    if (seq1 == seq2)
+      return;
+  }
+
+  throw std::runtime_error{"failed to read a consistent snapshot"};
+}
+
+
+
+static void print(const stats_segment_data& data)
+{
+  time_t startTime = data.startTime;
+  struct tm startTm;
+  localtime_r(&startTime, &startTm);
+
+  std::cout << "pid:         " << data.pid << "\n"
+            << "up since:    " << std::put_time(&startTm, "%Y-%m-%d %X") << "\n"
+            << "queue depth: " << data.queueDepth << "\n"
+            << "running:     " << data.running << "\n\n";
+
+  std::cout << std::left << std::setw(32) << "hook" << std::right
+            << std::setw(10) << "rejected" << std::setw(10) << "requests" << std::setw(10) << "accepted"
+            << std::setw(10) << "ignored" << std::setw(10) << "scheduled" << std::setw(10) << "succeeded"
+            << std::setw(10) << "failed" << std::setw(10) << "timedout" << std::setw(10) << "last[s]"
+            << std::setw(10) << "avg[s]" << std::setw(10) << "wait[s]" << "\n";
+
+  std::cout << std::fixed << std::setprecision(1);
+  for (std::uint64_t i = 0; i != data.hookCount && i != stats_segment_data::maxHooks; ++i)
+  {
+    auto& hook = data.hooks[i];
+    std::cout << std::left << std::setw(32) << hook.name << std::right
+              << std::setw(10) << hook.rejected << std::setw(10) << hook.requests << std::setw(10) << hook.accepted
+              << std::setw(10) << hook.ignored << std::setw(10) << hook.scheduled << std::setw(10) << hook.succeeded
+              << std::setw(10) << hook.failed << std::setw(10) << hook.timedOut << std::setw(10) << hook.lastDuration
+              << std::setw(10) << hook.avgDuration << std::setw(10) << hook.avgWait << "\n";
+  }
+}
+
+
+
+int main(int argc, char** argv)
+try {
+  const command_line cmdline{argc, argv};
+
+  auto shared = map_stats_file(cmdline.statsFile);
+  auto copy   = std::make_unique<stats_segment_data>();
+  read_snapshot(*shared, *copy);
+  print(*copy);
+
+  return 0;
+}
+catch (const std::exception& e)
+{
+  std::cerr << EXECUTABLE": " << e.what() << "\n";
+  return 1;
+}
@@ -0,0 +1,172 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "action_list.h"
+#include "io_context.h"
+#include "log.h"
+#include "metrics.h"
+#include "stats_segment.h"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <event2/event.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <system_error>
+#include <unistd.h>
+
+
+
+struct stats_segment::impl
+{
+  static impl* singleton;
+
+  std::unique_ptr<event,free_event> publishEv;
+  stats_segment_data* data{nullptr};
+  int fd{-1};
+  bool pending{false};
+
+  impl(io_context& context, const std::string& fileName);
+  ~impl();
+
+  void publish() noexcept;
+  static void publishCb(int, short, void* cls) noexcept;
+};
+
+
+stats_segment::impl* stats_segment::impl::singleton = nullptr;
+
+
+
+stats_segment::stats_segment(io_context& context, const std::string& fileName)
+  : m{new impl{context, fileName}}
+{}
+
+
+
+stats_segment::impl::impl(io_context& context, const std::string& fileName)
+  : publishEv{context.new_event<&publishCb>(-1, 0, this, "stats_segment::publishCb")}
+{
+  fd = open(fileName.c_str(), O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+  if (fd == -1)
+    throw std::system_error{errno, std::system_category(), "failed to open stats file " + fileName};
+
+  if (ftruncate(fd, sizeof(stats_segment_data)) == -1)
+  {
+    close(fd);
+    throw std::system_error{errno, std::system_category(), "failed to resize stats file " + fileName};
+  }
+
+  auto addr = mmap(nullptr, sizeof(stats_segment_data), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+  {
+    close(fd);
+    throw std::system_error{errno, std::system_category(), "failed to map stats file " + fileName};
+  }
+
+  data = static_cast<stats_segment_data*>(addr);
+  if (data->pid != getpid())
+  {
+    memset(static_cast<void*>(data), 0, sizeof(stats_segment_data));
+    memcpy(data->magic, stats_segment_data::magicValue, sizeof(data->magic));
+    data->version      = stats_segment_data::currentVersion;
+    data->hookCapacity = stats_segment_data::maxHooks;
+    data->pid          = getpid();
+    data->startTime    = std::time(nullptr);
+  }
+
+  assert(!singleton);
+  singleton = this;
+  publish();
+}
+
+
+
+void stats_segment::impl_delete::operator()(impl* p) noexcept
+{ delete p; }
+
+
+
+stats_segment::impl::~impl()
+{
+  munmap(data, sizeof(stats_segment_data));
+  close(fd);
+  singleton = nullptr;
+}
+
+
+
+void stats_segment::touch() noexcept
+{
+  auto self = impl::singleton;
+  if (!self || self->pending)
+    return;
+
+  self->pending = true;
+  event_active(self->publishEv.get(), 0, 0);
+}
+
+
+
+void stats_segment::impl::publishCb(int, short, void* cls) noexcept
+{
+  auto self = static_cast<impl*>(cls);
+  self->pending = false;
+  self->publish();
+}
+
+
+
+void stats_segment::impl::publish() noexcept
+{
+  auto hooks = metrics::hooks();
+  auto count = std::min<std::size_t>(hooks.size(), stats_segment_data::maxHooks);
+  auto seq   = data->sequence.load(std::memory_order_relaxed);
+
+  data->sequence.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  data->queueDepth = action_list::size() - action_list::running();
+  data->running    = action_list::running();
+  data->hookCount  = count;
+
+  for (std::size_t i = 0; i != count; ++i)
+  {
+    auto& src = hooks[i];
+    auto& dst = data->hooks[i];
+
+    auto nameLen = std::min(src.name.size(), sizeof(dst.name) - 1);
+    memcpy(dst.name, src.name.data(), nameLen);
+    dst.name[nameLen] = '\0';
+
+    dst.rejected     = src.rejected;
+    dst.requests     = src.requests;
+    dst.accepted     = src.accepted;
+    dst.ignored      = src.ignored;
+    dst.scheduled    = src.scheduled;
+    dst.executed     = src.executed;
+    dst.succeeded    = src.succeeded;
+    dst.failed       = src.failed;
+    dst.timedOut     = src.timedOut;
+    dst.lastFailure  = src.lastFailure;
+    dst.lastDuration = src.lastDuration;
+    dst.avgDuration  = src.avgDuration;
+    dst.avgWait      = src.avgWait;
+  }
+
+  data->sequence.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,97 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+class io_context;
+
+
+
+/// Statistics of a single hook in the stats segment.
+struct stats_segment_hook
+{
+  char name[64];
+  std::uint64_t rejected;
+  std::uint64_t requests;
+  std::uint64_t accepted;
+  std::uint64_t ignored;
+  std::uint64_t scheduled;
+  std::uint64_t executed;
+  std::uint64_t succeeded;
+  std::uint64_t failed;
+  std::uint64_t timedOut;
+  std::int64_t lastFailure;
+  double lastDuration;
+  double avgDuration;
+  double avgWait;
+};
+
+
+
+/// Fixed layout of the memory-mapped stats file, through which the program
+/// publishes its statistics to external readers such as gitlab-hook-stat.
+/// Writers increment the sequence number before and after an update, so that
+/// it is odd while the update is in progress (seqlock). Readers copy the
+/// data and retry if the sequence number was odd or has changed meanwhile.
+struct stats_segment_data
+{
+  static constexpr char magicValue[8] = {'G','L','H','S','T','A','T','S'};
+  static constexpr std::uint32_t currentVersion = 1;
+  static constexpr std::uint32_t maxHooks = 256;
+
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t hookCapacity;
+  std::atomic<std::uint64_t> sequence;
+  std::int64_t pid;
+  std::int64_t startTime;
+  std::uint64_t queueDepth;
+  std::uint64_t running;
+  std::uint64_t hookCount;
+  stats_segment_hook hooks[maxHooks];
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+
+
+/// Publishes the statistics of the program in a memory-mapped stats file. The
+/// file is updated after each change of the statistics, at most once per
+/// event loop iteration.
+class stats_segment
+{
+  public:
+    /// Creates or opens the stats file with given \a fileName, with
+    /// asynchronous I/O being done via the given I/O \a context.
+    stats_segment(io_context& context, const std::string& fileName);
+
+    /// Schedules an update of the stats file, if there is one.
+    static void touch() noexcept;
+
+  private:
+    struct impl;
+    struct impl_delete
+    {
+      constexpr impl_delete() noexcept = default;
+      void operator()(impl* p) noexcept;
+    };
+
+    std::unique_ptr<impl,impl_delete> m;
+};
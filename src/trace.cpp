@@ -0,0 +1,230 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "io_context.h"
+#include "log.h"
+#include "trace.h"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <event2/event.h>
+#include <fcntl.h>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <system_error>
+#include <unistd.h>
+
+
+
+static constexpr const char* stageNames[] = {
+  "received", "accepted", "body_complete", "parsed", "dispatched", "enqueued", "process_started", "process_exited"
+};
+
+static_assert(std::size(stageNames) == static_cast<std::size_t>(trace::stage::count));
+
+
+
+static std::string generate_event_id()
+{
+  static std::mt19937_64 generator{std::random_device{}()};
+  auto high = generator();
+  auto low  = generator();
+
+  // Random UUID version 4, variant 1.
+  high = (high & ~std::uint64_t{0xf000}) | 0x4000;
+  low  = (low & ~(std::uint64_t{3} << 62)) | (std::uint64_t{2} << 62);
+
+  char buffer[37];
+  snprintf(buffer, sizeof(buffer), "%08x-%04x-%04x-%04x-%012llx",
+           static_cast<unsigned>(high >> 32), static_cast<unsigned>((high >> 16) & 0xffff),
+           static_cast<unsigned>(high & 0xffff), static_cast<unsigned>(low >> 48),
+           static_cast<unsigned long long>(low & 0xffffffffffffull));
+
+  return buffer;
+}
+
+
+
+trace::trace(std::string_view eventId, std::string_view uriPath, clock::time_point received)
+  : mId{eventId.empty() ? generate_event_id() : std::string{eventId}},
+    mUriPath{uriPath}
+{ mStages[static_cast<std::size_t>(stage::received)] = received; }
+
+
+
+void trace::set_source(std::string_view peer, std::string_view projectPath, std::string_view pipelineId)
+{
+  mPeer        = peer;
+  mProjectPath = projectPath;
+  mPipelineId  = pipelineId;
+}
+
+
+
+log_fields trace::fields() const noexcept
+{
+  log_fields result;
+  result.hookName    = mHook;
+  result.projectPath = mProjectPath;
+  result.pipelineId  = mPipelineId;
+  result.eventId     = mId;
+  result.peer        = mPeer;
+  return result;
+}
+
+
+
+void trace::finish(std::string_view result) const
+{
+  if (*this)
+    trace_log::append(*this, result);
+}
+
+
+
+struct trace_log::impl
+{
+  static impl* singleton;
+
+  std::unique_ptr<event,free_event> flushEv;
+  std::string buffer;
+  int fd{-1};
+
+  impl(io_context& context, const std::string& fileName);
+  ~impl();
+
+  void flush() noexcept;
+  static void flushCb(int, short, void* cls) noexcept;
+};
+
+
+trace_log::impl* trace_log::impl::singleton = nullptr;
+
+constexpr std::size_t flushThreshold = 64 * 1024;
+
+
+
+trace_log::trace_log(io_context& context, const std::string& fileName)
+  : m{new impl{context, fileName}}
+{}
+
+
+
+trace_log::impl::impl(io_context& context, const std::string& fileName)
+  : flushEv{context.new_event<&flushCb>(-1, 0, this, "trace_log::flushCb")}
+{
+  fd = open(fileName.c_str(), O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0640);
+  if (fd == -1)
+    throw std::system_error{errno, std::system_category(), "failed to open trace file " + fileName};
+
+  assert(!singleton);
+  singleton = this;
+}
+
+
+
+void trace_log::impl_delete::operator()(impl* p) noexcept
+{ delete p; }
+
+
+
+trace_log::impl::~impl()
+{
+  flush();
+  close(fd);
+  singleton = nullptr;
+}
+
+
+
+void trace_log::append(const trace& trace, std::string_view result)
+{
+  auto self = impl::singleton;
+  if (!self)
+    return;
+
+  using namespace std::chrono;
+  auto received = trace.mStages.front();
+  auto wallTime = system_clock::now() - duration_cast<system_clock::duration>(trace::clock::now() - received);
+
+  nlohmann::json stages;
+  for (std::size_t i = 0; i != trace.mStages.size(); ++i)
+    if (trace.mStages[i] != trace::clock::time_point{})
+      stages[stageNames[i]] = duration_cast<microseconds>(trace.mStages[i] - received).count();
+
+  nlohmann::json line{
+    {"id",        trace.mId},
+    {"time",      duration<double>{wallTime.time_since_epoch()}.count()},
+    {"uri_path",  trace.mUriPath},
+    {"result",    result},
+    {"stages_us", std::move(stages)}};
+
+  if (!trace.mHook.empty())
+    line["hook"] = trace.mHook;
+
+  if (!trace.mPeer.empty())
+    line["peer"] = trace.mPeer;
+
+  if (!trace.mProjectPath.empty())
+    line["project_path"] = trace.mProjectPath;
+
+  if (!trace.mPipelineId.empty())
+    line["pipeline_id"] = trace.mPipelineId;
+
+  bool wasEmpty = self->buffer.empty();
+  self->buffer += line.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+  self->buffer += '\n';
+
+  if (self->buffer.size() >= flushThreshold)
+    self->flush();
+  else if (wasEmpty)
+  {
+    timeval tm{};
+    tm.tv_sec = 1;
+    event_add(self->flushEv.get(), &tm);
+  }
+}
+
+
+
+void trace_log::impl::flushCb(int, short, void* cls) noexcept
+{ static_cast<impl*>(cls)->flush(); }
+
+
+
+void trace_log::impl::flush() noexcept
+{
+  event_del(flushEv.get());
+
+  std::string_view data{buffer};
+  while (!data.empty())
+  {
+    auto written = write(fd, data.data(), data.size());
+    if (written == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      log_error("failed to write trace file: %s", strerror(errno));
+      break;
+    }
+
+    data.remove_prefix(static_cast<std::size_t>(written));
+  }
+
+  buffer.clear();
+}
@@ -0,0 +1,111 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "log.h"
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+class io_context;
+
+
+
+/// Timestamps of the stages that a webhook event passes through, from
+/// receiving the HTTP request until the hook's command exits. Identified by
+/// the event id, which correlates the trace with the log of the command.
+class trace
+{
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /// List of stages, in chronological order.
+    enum class stage
+    { received, accepted, body_complete, parsed, dispatched, enqueued, process_started, process_exited, count };
+
+    /// Constructs an empty trace, which is never written.
+    trace() = default;
+
+    /// Constructs a trace for a request that was \a received at the given
+    /// time, with the \a eventId from the request's X-Gitlab-Event-UUID
+    /// header. Generates a random id if \a eventId is empty.
+    trace(std::string_view eventId, std::string_view uriPath, clock::time_point received);
+
+    /// Whether this trace is not empty.
+    explicit operator bool() const noexcept
+    { return !mId.empty(); }
+
+    /// The event id.
+    const std::string& id() const noexcept
+    { return mId; }
+
+    /// Records the current time for \a stage.
+    void mark(stage stage) noexcept
+    { mStages[static_cast<std::size_t>(stage)] = clock::now(); }
+
+    /// Sets the \a name of the hook that handles the event.
+    void set_hook(std::string_view name)
+    { mHook = name; }
+
+    /// Sets the address of the \a peer that sent the event, and the \a
+    /// projectPath and \a pipelineId from the event, if any.
+    void set_source(std::string_view peer, std::string_view projectPath, std::string_view pipelineId);
+
+    /// The fields to attach to log messages about the event.
+    log_fields fields() const noexcept;
+
+    /// Writes the trace with the given \a result to the trace_log, if there
+    /// is one.
+    void finish(std::string_view result) const;
+
+  private:
+    friend class trace_log;
+
+    std::string mId;
+    std::string mUriPath;
+    std::string mHook;
+    std::string mPeer;
+    std::string mProjectPath;
+    std::string mPipelineId;
+    std::array<clock::time_point,static_cast<std::size_t>(stage::count)> mStages{};
+};
+
+
+
+/// A file to which finished traces are appended as JSON lines. Lines are
+/// collected and written in batches, at most once per second.
+class trace_log
+{
+  public:
+    /// Opens the trace log file with given \a fileName, and flushes it via
+    /// the I/O \a context.
+    trace_log(io_context& context, const std::string& fileName);
+
+  private:
+    friend class trace;
+    static void append(const trace& trace, std::string_view result);
+
+    struct impl;
+    struct impl_delete
+    {
+      constexpr impl_delete() noexcept = default;
+      void operator()(impl* p) noexcept;
+    };
+
+    std::unique_ptr<impl,impl_delete> m;
+};
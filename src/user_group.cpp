@@ -81,3 +81,32 @@ void user_group::impersonate()
   if (setuid(mUid) == -1)
     throw std::system_error{errno, std::system_category(), "failed to set process user id"};
 }
+
+
+
+std::vector<unsigned int> user_group::supplementary_groups() const
+{
+  assert(mUid != Invalid && mGid != Invalid);
+
+  auto info = getpwuid(mUid);
+  if (!info)
+    throw std::system_error{errno, std::system_category(), "failed to read user information"};
+
+  std::vector<gid_t> groups(16);
+  for (;;)
+  {
+    auto count = static_cast<int>(groups.size());
+    if (getgrouplist(info->pw_name, info->pw_gid, groups.data(), &count) != -1)
+    {
+      groups.resize(static_cast<std::size_t>(count));
+      break;
+    }
+
+    if (static_cast<std::size_t>(count) <= groups.size())
+      throw std::runtime_error{"failed to read additional process groups"};
+
+    groups.resize(static_cast<std::size_t>(count));
+  }
+
+  return {groups.begin(), groups.end()};
+}
@@ -18,6 +18,7 @@
 #pragma once
 #include <climits>
 #include <string>
+#include <vector>
 
 
 
@@ -36,15 +37,33 @@ class user_group
     /// \a groupName.
     user_group(const std::string& userName, const std::string& groupName);
 
+    /// Constructs an identity from a numeric user \a uid and group \a gid.
+    constexpr user_group(unsigned int uid, unsigned int gid) noexcept
+      : mUid{uid},
+        mGid{gid}
+    {}
+
     /// Whether this is a (default-constructed) null identity.
     explicit operator bool() const noexcept
     { return mUid != Invalid && mGid != Invalid; }
 
+    /// The numeric user ID.
+    unsigned int uid() const noexcept
+    { return mUid; }
+
+    /// The numeric group ID.
+    unsigned int gid() const noexcept
+    { return mGid; }
+
     /// Attempts to set the process's real and effective user and group ID
     /// to this identity. This will effectively drop super-user privileges, if
     /// this process had them before. Throws if not successful.
     void impersonate();
 
+    /// The supplementary groups impersonate() would set, that is, the groups
+    /// the user is a member of. Throws if they cannot be read.
+    std::vector<unsigned int> supplementary_groups() const;
+
   private:
     constexpr static unsigned int Invalid = UINT_MAX;
 
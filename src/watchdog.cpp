@@ -16,35 +16,152 @@
     with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
 */
 #include "io_context.h"
+#include "log.h"
 #include "watchdog.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
 #include <event2/event.h>
 #include <systemd/sd-daemon.h>
 
 
 
-static void watchdogCb(int, short what, void*) noexcept
+using namespace std::chrono_literals;
+using std::chrono::steady_clock;
+constexpr auto tickInterval = 250ms;
+
+
+
+struct watchdog::impl
 {
-  if (what & EV_TIMEOUT)
-    sd_notify(0, "WATCHDOG=1\n");
-}
+  std::unique_ptr<event,free_event> tickEv;
+  std::chrono::milliseconds maxLag;
+  duration notifyInterval{};
+  steady_clock::time_point expected;
+  steady_clock::time_point lastNotify;
+  std::array<duration,240> samples{};
+  std::size_t sampleCount{0};
+  duration longest{};
+  std::array<char,256> longestCause{};  ///< of the longest lag, or empty
+
+  impl(io_context& context, std::chrono::milliseconds maxLag) noexcept;
+  void schedule() noexcept;
+  void tick() noexcept;
 
+  static void tickCb(int, short, void* cls) noexcept;
+};
 
 
-watchdog::watchdog(io_context& context)
+
+watchdog::watchdog(io_context& context, std::chrono::milliseconds maxLag)
+  : m{new impl{context, maxLag}}
+{}
+
+
+inline watchdog::impl::impl(io_context& context, std::chrono::milliseconds maxLag_) noexcept
+  : tickEv{context.new_event<&tickCb>(-1, 0, this, "watchdog::tickCb")},
+    maxLag{maxLag_}
 {
   uint64_t usec;
   if (sd_watchdog_enabled(0, &usec) > 0)
   {
-    timeval tm;
-    tm.tv_sec  = static_cast<long>(usec % 1000000u);
-    tm.tv_usec = static_cast<long>(usec - static_cast<uint64_t>(tm.tv_sec) * 1000000u);
+    notifyInterval = std::chrono::microseconds{usec / 2};
+    if (maxLag >= notifyInterval)
+      log_warning("watchdog_max_lag is not below half the systemd watchdog interval");
+
+    sd_notify(0, "WATCHDOG=1\n");
+    lastNotify = steady_clock::now();
+  }
+
+  schedule();
+}
+
+
+void watchdog::impl_delete::operator()(impl* p) noexcept
+{ delete p; }
+
+
+
+void watchdog::impl::schedule() noexcept
+{
+  timeval tm{};
+  tm.tv_usec = std::chrono::duration_cast<std::chrono::microseconds>(tickInterval).count();
+
+  expected = steady_clock::now() + tickInterval;
+  event_add(tickEv.get(), &tm);
+}
+
+
+
+void watchdog::impl::tickCb(int, short, void* cls) noexcept
+{ static_cast<impl*>(cls)->tick(); }
+
+
+
+void watchdog::impl::tick() noexcept
+{
+  auto now = steady_clock::now();
+  auto lag = std::max(now - expected, duration::zero());
+
+  samples[sampleCount++ % samples.size()] = lag;
+
+  // The slowest callback since the last tick delayed this one.
+  auto culprit = io_context::slowest_callback();
+  std::array<char,256> cause{};
+  if (culprit.name && (lag > longest || lag >= maxLag))
+  {
+    if (culprit.subject.empty())
+      snprintf(cause.data(), cause.size(), "callback %s", culprit.name);
+    else
+      snprintf(cause.data(), cause.size(), "callback %s handling %.*s", culprit.name,
+               static_cast<int>(culprit.subject.size()), culprit.subject.data());
+  }
 
-    m.reset(evtimer_new(context.native_handle(), &watchdogCb, nullptr));
-    event_add(m.get(), &tm);
+  if (lag > longest)
+  {
+    longest = lag;
+    longestCause = cause;
   }
+
+  if (lag >= maxLag)
+  {
+    auto msecs = static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(lag).count());
+    if (cause.front())
+      log_warning("event loop lagged %lli ms behind after %s, withholding watchdog trigger", msecs, cause.data());
+    else
+      log_warning("event loop lagged %lli ms behind, withholding watchdog trigger", msecs);
+  }
+  else if (notifyInterval != duration::zero() && now - lastNotify >= notifyInterval)
+  {
+    sd_notify(0, "WATCHDOG=1\n");
+    lastNotify = now;
+  }
+
+  schedule();
 }
 
 
 
-void watchdog::delete_event::operator()(event* p) noexcept
-{ event_free(p); }
+watchdog::lag_summary watchdog::lag() const noexcept
+{
+  auto count = std::min(m->sampleCount, m->samples.size());
+  if (count == 0)
+    return {};
+
+  auto sorted = m->samples;
+  auto begin  = sorted.begin();
+  auto end    = begin + static_cast<std::ptrdiff_t>(count);
+  std::sort(begin, end);
+
+  auto at = [&](std::size_t percent)
+  { return sorted[(count - 1) * percent / 100]; };
+
+  lag_summary result;
+  result.p50     = at(50);
+  result.p90     = at(90);
+  result.p99     = at(99);
+  result.max     = sorted[count - 1];
+  result.longest = m->longest;
+  result.longestCause = m->longestCause.data();
+  return result;
+}
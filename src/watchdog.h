@@ -16,27 +16,52 @@
     with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <chrono>
 #include <memory>
+#include <string_view>
 class io_context;
-struct event;
 
 
 
-/// An automatic trigger for the SystemD watchdog.
+/// An automatic trigger for the SystemD watchdog that monitors the health of
+/// the event loop.
 class watchdog
 {
   public:
-    /// Constructs and starts the watchdog. As long as the \a context's event
-    /// loop is running, it will regularly trigger the SystemD watchdog to
-    /// prevent it from shutting down the application.
-    explicit watchdog(io_context& context);
+    using duration = std::chrono::steady_clock::duration;
+
+    /// Summary of the event loop lag, see lag().
+    struct lag_summary
+    {
+      duration p50{};
+      duration p90{};
+      duration p99{};
+      duration max{};
+      duration longest{};
+      std::string_view longestCause;  ///< the slowest callback before the longest lag, if known
+    };
+
+    /// Constructs and starts the watchdog. It measures how late a periodic
+    /// timer fires in the \a context's event loop, which is the time the loop
+    /// was blocked by other callbacks. As long as this lag stays below \a
+    /// maxLag, it regularly triggers the SystemD watchdog to prevent it from
+    /// shutting down the application.
+    watchdog(io_context& context, std::chrono::milliseconds maxLag);
+
+    /// Returns percentiles and maximum of the lag over the last minute, and
+    /// the longest lag since the watchdog started. If the profiler of the
+    /// io_context is enabled, the cause of the longest lag is the slowest
+    /// callback that ran before, and the subject it was working on. It is
+    /// valid until the event loop continues.
+    lag_summary lag() const noexcept;
 
   private:
-    struct delete_event
+    struct impl;
+    struct impl_delete
     {
-      constexpr delete_event() noexcept = default;
-      void operator()(event* p) noexcept;
+      constexpr impl_delete() noexcept = default;
+      void operator()(impl* p) noexcept;
     };
 
-    std::unique_ptr<event,delete_event> m;
+    std::unique_ptr<impl,impl_delete> m;
 };
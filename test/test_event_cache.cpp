@@ -0,0 +1,86 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "test.h" // precompiled
+#include "event_cache.h"
+#include <chrono>
+
+
+
+using namespace std::chrono_literals;
+
+
+
+TEST(event_cache, without_cache)
+{
+  event_cache::remember("a");
+  EXPECT_FALSE(event_cache::contains("a"));
+}
+
+
+
+TEST(event_cache, remember)
+{
+  event_cache cache{16, 3600s, {}};
+  EXPECT_FALSE(event_cache::contains("a"));
+
+  event_cache::remember("a");
+  EXPECT_TRUE(event_cache::contains("a"));
+  EXPECT_FALSE(event_cache::contains("b"));
+}
+
+
+
+TEST(event_cache, expiry)
+{
+  event_cache cache{16, 0s, {}};
+  event_cache::remember("a");
+  EXPECT_FALSE(event_cache::contains("a"));
+}
+
+
+
+TEST(event_cache, redelivery_while_receiving)
+{
+  event_cache cache{16, 3600s, {}};
+
+  // The first request remembers its id before its content is complete, so
+  // that a second one with the same id is a duplicate.
+  ASSERT_FALSE(event_cache::contains("uuid"));
+  event_cache::remember("uuid");
+  EXPECT_TRUE(event_cache::contains("uuid"));
+
+  // If the first request fails, the event can be delivered again.
+  event_cache::forget("uuid");
+  EXPECT_FALSE(event_cache::contains("uuid"));
+}
+
+
+
+TEST(event_cache, forget_keeps_others)
+{
+  event_cache cache{8, 3600s, {}};
+  for (char c = 'a'; c != 'f'; ++c)
+    event_cache::remember(std::string(1, c));
+
+  event_cache::forget("c");
+  EXPECT_TRUE(event_cache::contains("a"));
+  EXPECT_TRUE(event_cache::contains("b"));
+  EXPECT_FALSE(event_cache::contains("c"));
+  EXPECT_TRUE(event_cache::contains("d"));
+  EXPECT_TRUE(event_cache::contains("e"));
+}
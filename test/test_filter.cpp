@@ -0,0 +1,126 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "test.h" // precompiled
+#include "filter.h"
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+
+
+static const nlohmann::json event = nlohmann::json::parse(R"({
+  "object_kind": "pipeline",
+  "object_attributes": {"ref": "release/1.2", "status": "success", "duration": 75, "tag": false},
+  "builds": [{"name": "build-image:amd64", "status": "success"}, {"name": "test", "status": "failed"}],
+  "a/b": {"c~d": 1}
+})");
+
+
+static bool matches(std::string_view expression)
+{ return filter{expression}.matches(event); }
+
+
+
+TEST(filter, empty)
+{ EXPECT_TRUE(filter{}.matches(event)); }
+
+
+
+TEST(filter, comparisons)
+{
+  EXPECT_TRUE(matches(R"(/object_attributes/status == "success")"));
+  EXPECT_FALSE(matches(R"(/object_attributes/status != "success")"));
+  EXPECT_TRUE(matches("/object_attributes/duration > 60"));
+  EXPECT_TRUE(matches("/object_attributes/duration >= 75.0"));
+  EXPECT_FALSE(matches("/object_attributes/duration < 75"));
+  EXPECT_TRUE(matches("/object_attributes/duration <= 75"));
+  EXPECT_TRUE(matches(R"(/object_attributes/ref > "a")"));
+  EXPECT_FALSE(matches(R"(/object_attributes/duration > "a")"));
+}
+
+
+
+TEST(filter, operators_without_spaces)
+{
+  EXPECT_TRUE(matches("/object_attributes/duration>60"));
+  EXPECT_FALSE(matches("/object_attributes/duration<=60"));
+  EXPECT_TRUE(matches(R"(/object_attributes/ref=~"^release/")"));
+  EXPECT_TRUE(matches(R"(/object_attributes/status!="failed")"));
+}
+
+
+
+TEST(filter, regular_expressions)
+{
+  EXPECT_TRUE(matches(R"(/object_attributes/ref =~ "^release/")"));
+  EXPECT_FALSE(matches(R"(/object_attributes/ref =~ "^main")"));
+  EXPECT_TRUE(matches(R"(/object_attributes/ref !~ "^main")"));
+  EXPECT_TRUE(matches(R"(/object_attributes/ref =~ "(?i)^RELEASE/\\d+\\.\\d+$")"));
+  EXPECT_FALSE(matches(R"(/object_attributes/duration =~ "75")"));
+}
+
+
+
+TEST(filter, lists)
+{
+  EXPECT_TRUE(matches(R"(/object_attributes/status in ["success", "failed"])"));
+  EXPECT_FALSE(matches("/object_attributes/status in []"));
+  EXPECT_TRUE(matches("/object_attributes/duration in [1, 75]"));
+}
+
+
+
+TEST(filter, existence)
+{
+  EXPECT_TRUE(matches("/object_attributes/ref"));
+  EXPECT_FALSE(matches("/object_attributes/tag"));
+  EXPECT_FALSE(matches("/object_attributes/missing"));
+  EXPECT_FALSE(matches("/object_attributes/missing == 3"));
+  EXPECT_TRUE(matches("/object_attributes/missing != 3"));
+  EXPECT_TRUE(matches(R"(/object_attributes/missing !~ "x")"));
+}
+
+
+
+TEST(filter, pointers)
+{
+  EXPECT_TRUE(matches(R"(/builds/1/status == "failed")"));
+  EXPECT_FALSE(matches(R"(/builds/2/status == "failed")"));
+  EXPECT_TRUE(matches(R"(/builds/*/name == "test")"));
+  EXPECT_FALSE(matches(R"(/builds/*/name == "deploy")"));
+  EXPECT_TRUE(matches("/a~1b/c~0d == 1"));
+}
+
+
+
+TEST(filter, logic)
+{
+  EXPECT_TRUE(matches(R"(/builds/*/name =~ "^build-image:" and not /object_attributes/tag)"));
+  EXPECT_TRUE(matches(R"((/object_kind == "push" or /object_kind == "pipeline") and /a~1b/c~0d == 1)"));
+  EXPECT_FALSE(matches(R"(not (/object_kind == "pipeline"))"));
+  EXPECT_FALSE(matches(R"(/object_kind == "push" or /object_kind == "x" and /object_kind == "pipeline")"));
+  EXPECT_TRUE(matches(R"(/object_kind == "pipeline" or /object_kind == "x" and /object_kind == "push")"));
+}
+
+
+
+TEST(filter, invalid)
+{
+  for (auto expression: {"", "/a ==", "/a == [1", "foo", "/a =~ 3", "/a in 3", "(/a", "/a == 1 )", "/a < true",
+                         "/a == \"x", "/a =~ \"(\"", "/a~2", "/a == [[1]]", "/a = 1", "/a ! 1"})
+    EXPECT_THROW(filter{expression}, std::runtime_error) << expression;
+}
@@ -0,0 +1,216 @@
+/*  Copyright 2024 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of gitlab-hook.
+
+    Gitlab-hook is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    Gitlab-hook is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along
+    with gitlab-hook. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "test.h" // precompiled
+#include "pattern.h"
+#include <stdexcept>
+
+
+
+static bool match(std::string_view regex, std::string_view text)
+{
+  pattern_set patterns;
+  patterns.add_regex(regex);
+  patterns.compile();
+  return patterns.matches(text);
+}
+
+
+
+TEST(pattern_set, empty)
+{
+  pattern_set patterns;
+  patterns.compile();
+  EXPECT_FALSE(patterns.matches(""));
+  EXPECT_FALSE(patterns.matches("text"));
+}
+
+
+
+TEST(pattern_set, regex_anchors)
+{
+  EXPECT_TRUE(match("abc", "xxabcxx"));
+  EXPECT_FALSE(match("^abc", "xxabc"));
+  EXPECT_TRUE(match("abc$", "xxabc"));
+  EXPECT_FALSE(match("abc$", "abcx"));
+  EXPECT_TRUE(match("^$", ""));
+  EXPECT_FALSE(match("^$", "a"));
+  EXPECT_TRUE(match("(^|/)main$", "refs/main"));
+  EXPECT_TRUE(match("(^|/)main$", "main"));
+  EXPECT_FALSE(match("(^|/)main$", "xmain"));
+  EXPECT_TRUE(match("", "anything"));
+}
+
+
+
+TEST(pattern_set, regex_alternatives_and_groups)
+{
+  EXPECT_TRUE(match("a|b", "zzb"));
+  EXPECT_TRUE(match("^(foo|bar)+$", "foobarfoo"));
+  EXPECT_FALSE(match("^(foo|bar)+$", "foobaz"));
+  EXPECT_TRUE(match("^(?:ma(in|ster))$", "master"));
+  EXPECT_FALSE(match("^$|x", "abc"));
+}
+
+
+
+TEST(pattern_set, regex_repetition)
+{
+  EXPECT_TRUE(match("^a{2,3}$", "aa"));
+  EXPECT_TRUE(match("^a{2,3}$", "aaa"));
+  EXPECT_FALSE(match("^a{2,3}$", "aaaa"));
+  EXPECT_TRUE(match("^a{2,}$", "aaaaa"));
+  EXPECT_FALSE(match("^a{2,}$", "a"));
+  EXPECT_TRUE(match("^a{2}$", "aa"));
+  EXPECT_TRUE(match("x?y", "y"));
+  EXPECT_TRUE(match("^a*b$", "b"));
+  EXPECT_TRUE(match("^a+b$", "aab"));
+  EXPECT_FALSE(match("^a+b$", "b"));
+}
+
+
+
+TEST(pattern_set, regex_classes)
+{
+  EXPECT_TRUE(match("[0-9]+\\.[0-9]", "v1.2"));
+  EXPECT_FALSE(match("[^a-z]", "abc"));
+  EXPECT_TRUE(match("[-a]", "-"));
+  EXPECT_TRUE(match("[a-]", "-"));
+  EXPECT_TRUE(match("[\\]]", "]"));
+  EXPECT_TRUE(match("\\d\\d", "a12"));
+  EXPECT_TRUE(match("\\w+@\\w+", "x foo@bar"));
+  EXPECT_FALSE(match("\\s", "nospace"));
+  EXPECT_TRUE(match("^release/[0-9]+$", "release/12"));
+  EXPECT_FALSE(match("^release/[0-9]+$", "release/12a"));
+  EXPECT_FALSE(match("a.c", "a\nc"));
+  EXPECT_TRUE(match("a.c", "abc"));
+}
+
+
+
+TEST(pattern_set, regex_case_insensitive)
+{
+  EXPECT_TRUE(match("(?i)^MaIn$", "main"));
+  EXPECT_TRUE(match("(?i)^MaIn$", "MAIN"));
+  EXPECT_FALSE(match("(?i)^MaIn$", "mainx"));
+  EXPECT_FALSE(match("^MaIn$", "main"));
+}
+
+
+
+TEST(pattern_set, globs_and_literals)
+{
+  pattern_set patterns;
+  patterns.add_glob("feature/*");
+  patterns.add_literal("a*b");
+  patterns.add_glob("v?.?");
+  patterns.add_glob("main");
+  patterns.compile();
+
+  EXPECT_TRUE(patterns.matches("feature/x"));
+  EXPECT_FALSE(patterns.matches("feature/x/y"));
+  EXPECT_TRUE(patterns.matches("a*b"));
+  EXPECT_FALSE(patterns.matches("axb"));
+  EXPECT_TRUE(patterns.matches("v1.2"));
+  EXPECT_FALSE(patterns.matches("v1/2"));
+  EXPECT_TRUE(patterns.matches("main"));
+  EXPECT_FALSE(patterns.matches("mainx"));
+  EXPECT_FALSE(patterns.matches(""));
+}
+
+
+
+TEST(pattern_set, globstar)
+{
+  pattern_set patterns;
+  patterns.add_glob("**/*.cpp");
+  patterns.compile();
+
+  EXPECT_TRUE(patterns.matches("src/a.cpp"));
+  EXPECT_TRUE(patterns.matches("x/y/z.cpp"));
+  EXPECT_TRUE(patterns.matches("a.cpp"));
+  EXPECT_FALSE(patterns.matches("src/a.h"));
+
+  pattern_set inner;
+  inner.add_glob("src/**/test/*.cpp");
+  inner.add_glob("docs/**");
+  inner.add_glob("lib**");
+  inner.compile();
+
+  EXPECT_TRUE(inner.matches("src/test/a.cpp"));
+  EXPECT_TRUE(inner.matches("src/x/y/test/a.cpp"));
+  EXPECT_FALSE(inner.matches("src/xtest/a.cpp"));
+  EXPECT_TRUE(inner.matches("docs/a/b.md"));
+  EXPECT_FALSE(inner.matches("docs"));
+  EXPECT_FALSE(inner.matches("doc/a.md"));
+  EXPECT_TRUE(inner.matches("libfoo/a.cpp"));
+}
+
+
+
+TEST(pattern_set, any_of_several_patterns)
+{
+  pattern_set patterns;
+  patterns.add_regex("^deploy");
+  patterns.add_regex("prod");
+  patterns.add_literal("release");
+  patterns.compile();
+
+  EXPECT_TRUE(patterns.matches("deploy-staging"));
+  EXPECT_TRUE(patterns.matches("test-prod"));
+  EXPECT_TRUE(patterns.matches("release"));
+  EXPECT_FALSE(patterns.matches("test-staging"));
+}
+
+
+
+TEST(pattern_set, many_literals)
+{
+  pattern_set patterns;
+  for (int i = 0; i != 10000; ++i)
+    patterns.add_glob("job-" + std::to_string(i));
+
+  patterns.add_glob("build-*");
+  patterns.compile();
+
+  EXPECT_EQ(patterns.size(), 10001u);
+  EXPECT_TRUE(patterns.matches("job-0"));
+  EXPECT_TRUE(patterns.matches("job-9999"));
+  EXPECT_FALSE(patterns.matches("job-10000"));
+  EXPECT_TRUE(patterns.matches("build-image"));
+}
+
+
+
+TEST(pattern_set, invalid_regex)
+{
+  for (auto regex: {"(a", "a)", "*a", "a{3,1}", "\\1", "(?=a)", "[a", "a{", "[z-a]"})
+  {
+    pattern_set patterns;
+    patterns.add_regex(regex);
+    EXPECT_THROW(patterns.compile(), std::runtime_error) << regex;
+  }
+}
+
+
+
+TEST(pattern_set, too_complex)
+{
+  pattern_set patterns;
+  patterns.add_regex("(a|b)*a(a|b){14}");
+  EXPECT_THROW(patterns.compile(), std::runtime_error);
+}